@@ -0,0 +1,467 @@
+/*****************************************************************************
+ *
+ * capture.cpp - the raw capture format and the recorded event decoder of
+ * the xmacro utilities.
+ *
+ * Portions Copyright (C) 2000 Gabor Keresztfalvi <keresztg@mail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <string.h>
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/extensions/record.h>
+
+#include "capture.h"
+#include "trace.h"
+
+using namespace std;
+
+/****************************************************************************/
+/*! Fills in the header \a h of a capture starting with the pointer at \a x,
+    \a y.
+*/
+/****************************************************************************/
+void beginCapture (CaptureHeader & h, int x, int y) {
+
+  memset ( &h, 0, sizeof (h) );
+  memcpy ( h.Magic, CAPTURE_MAGIC, sizeof (h.Magic) );
+  h.Version = CaptureVersion;
+  h.ByteOrder = CaptureByteOrder;
+  h.PointerX = x;
+  h.PointerY = y;
+}
+
+/****************************************************************************/
+/*! Returns true if \a h starts a capture we can decode.
+*/
+/****************************************************************************/
+bool checkCapture (const CaptureHeader & h) {
+
+  return ! memcmp ( h.Magic, CAPTURE_MAGIC, sizeof (h.Magic) )
+	&& h.Version == CaptureVersion && h.ByteOrder == CaptureByteOrder;
+}
+
+/****************************************************************************/
+/*! Appends the keyboard mapping \a Map to \a Out as capture records: one
+    CaptureKeyMap record and as many CaptureKeySyms records as it takes.
+*/
+/****************************************************************************/
+void captureKeyMap (const KeyMap & Map, vector<CaptureRecord> & Out) {
+
+  CaptureRecord r;
+  int32_t Shape[3] = { Map.MinCode, Map.MaxCode, Map.PerCode };
+  uint32_t Syms[CaptureSymsSize];
+  int kc, First, Count, i;
+
+  memset ( &r, 0, sizeof (r) );
+  r.Kind = CaptureKeyMap;
+  r.Len = sizeof (Shape);
+  memcpy ( r.Data, Shape, sizeof (Shape) );
+  Out.push_back ( r );
+
+  r.Kind = CaptureKeySyms;
+  for ( kc = Map.MinCode; kc <= Map.MaxCode; kc++ ) {
+	for ( First = 0; First < Map.PerCode; First += Count ) {
+	  Count = min ( (int) CaptureSymsSize, Map.PerCode - First );
+	  for ( i = 0; i < Count; i++ )
+		Syms[i] = Map.Syms[( kc - Map.MinCode ) * Map.PerCode + First + i];
+
+	  r.Data[0] = kc;
+	  r.Data[1] = First;
+	  r.Data[2] = Count;
+	  r.Len = 4 + Count * sizeof (uint32_t);
+	  memcpy ( r.Data + 4, Syms, Count * sizeof (uint32_t) );
+	  Out.push_back ( r );
+	}
+  }
+}
+
+/****************************************************************************/
+/*! Fills in \a r as a checkpoint set at server time \a Time: a WaitForPixels
+    at \a x, \a y for \a Region.
+*/
+/****************************************************************************/
+void captureCheckpoint (CaptureRecord & r, uint32_t Time, int x, int y, const MacroRegion & Region) {
+
+  int32_t At[2] = { x, y };
+
+  memset ( &r, 0, sizeof (r) );
+  r.Time = Time;
+  r.Kind = CaptureCheckpoint;
+  r.Len = sizeof (At) + sizeof (Region);
+  memcpy ( r.Data, At, sizeof (At) );
+  memcpy ( r.Data + sizeof (At), &Region, sizeof (Region) );
+}
+
+/****************************************************************************/
+/*! Applies the keyboard mapping record \a r to \a Map. Returns false if it
+    does not fit the mapping started before.
+*/
+/****************************************************************************/
+bool readCaptureKeyMap (const CaptureRecord & r, KeyMap & Map) {
+
+  int32_t Shape[3];
+  uint32_t Syms[CaptureSymsSize];
+  int kc = r.Data[0], First = r.Data[1], Count = r.Data[2], i;
+
+  if ( r.Kind == CaptureKeyMap ) {
+	memcpy ( Shape, r.Data, sizeof (Shape) );
+	if ( Shape[0] > Shape[1] || Shape[2] < 0 ) return false;
+	Map.MinCode = Shape[0];
+	Map.MaxCode = Shape[1];
+	Map.PerCode = Shape[2];
+	Map.Syms.assign ( ( Map.MaxCode - Map.MinCode + 1 ) * Map.PerCode, NoSymbol );
+	return true;
+  }
+
+  if ( kc < Map.MinCode || kc > Map.MaxCode || Count > (int) CaptureSymsSize
+	   || First + Count > Map.PerCode )
+	return false;
+
+  memcpy ( Syms, r.Data + 4, Count * sizeof (uint32_t) );
+  for ( i = 0; i < Count; i++ )
+	Map.Syms[( kc - Map.MinCode ) * Map.PerCode + First + i] = Syms[i];
+  return true;
+}
+
+/****************************************************************************/
+/*! Starts decoding with the pointer at \a x, \a y. With \a Timing Delay
+    events are emitted for the time between the events. The keys, the
+	keyboard mapping and where the events go are set by the caller.
+*/
+/****************************************************************************/
+void startDecoder (EventDecoder & D, int x, int y, bool Timing) {
+
+  D.x = x;
+  D.y = y;
+  D.mmoved = 1;
+  D.Status2 = 0;
+  D.Status1 = 2;
+  D.Timing = Timing;
+  D.Time = D.LastTime = D.mtime = 0;
+  D.Tolerance = 0;
+  D.Resolution = 0;
+  D.Drag.clear ();
+  D.DragPoints = D.DragKept = 0;
+}
+
+/****************************************************************************/
+/*! Hands the event \a Op with the operands \a A and \a B to the emitter.
+*/
+/****************************************************************************/
+static void emit (EventDecoder & D, int Op, int32_t A, int32_t B) {
+
+  MacroEvent ev;
+
+  memset ( &ev, 0, sizeof (ev) );
+  ev.Op = Op;
+  ev.A = A;
+  ev.B = B;
+  D.Emit ( D.Arg, ev, 0 );
+}
+
+/****************************************************************************/
+/*! Emits a Delay for the time passed between the previously emitted event
+    and the one at server time \a t, if timing was asked for.
+*/
+/****************************************************************************/
+static void emitDelay (EventDecoder & D, uint32_t t) {
+
+  if ( ! D.Timing ) return;
+  if ( D.LastTime && t > D.LastTime )
+	emit ( D, OpDelay, ( t - D.LastTime ) / 1000, ( t - D.LastTime ) % 1000 * 1000 );
+  D.LastTime = t;
+}
+
+/****************************************************************************/
+/*! Emits the pointer motion held back since the last event, if any.
+*/
+/****************************************************************************/
+static void emitMotion (EventDecoder & D) {
+
+  if ( ! D.mmoved ) return;
+  emitDelay ( D, D.mtime );
+  emit ( D, OpMotionNotify, D.x, D.y );
+  D.mmoved = 0;
+}
+
+/****************************************************************************/
+/*! Returns the square of the distance of \a p from the line segment from
+    \a a to \a b.
+*/
+/****************************************************************************/
+static double segmentDistance2 (const MotionPoint & p, const MotionPoint & a,
+								const MotionPoint & b) {
+
+  double dx = b.x - a.x, dy = b.y - a.y, px = p.x - a.x, py = p.y - a.y;
+  double Length2 = dx * dx + dy * dy, t;
+
+  if ( Length2 > 0 ) {
+	t = max ( 0.0, min ( 1.0, ( px * dx + py * dy ) / Length2 ) );
+	px -= t * dx;
+	py -= t * dy;
+  }
+  return px * px + py * py;
+}
+
+/****************************************************************************/
+/*! Emits the drag collected so far, simplified with the Ramer-Douglas-Peucker
+    algorithm: of the points between two kept ones, the one furthest from
+	the line between them is kept if it is further than the Tolerance, and
+	the halves are looked at the same way. The first point is where the
+	drag started and was emitted before, the last one is always kept.
+*/
+/****************************************************************************/
+static void emitDrag (EventDecoder & D) {
+
+  vector<MotionPoint> & P = D.Drag;
+  vector<char> Keep ( P.size (), 0 );
+  vector<pair<size_t, size_t> > Todo;
+  double Tolerance2 = (double) D.Tolerance * D.Tolerance, Far, d;
+  size_t a, b, i, k, Farthest;
+
+  if ( P.size () < 2 ) {
+	P.clear ();
+	return;
+  }
+
+  Keep[0] = Keep[P.size () - 1] = 1;
+  Todo.push_back ( make_pair ( (size_t) 0, P.size () - 1 ) );
+  while ( ! Todo.empty () ) {
+	a = Todo.back ().first;
+	b = Todo.back ().second;
+	Todo.pop_back ();
+
+	for ( Far = 0, Farthest = a, i = a + 1; i < b; i++ )
+	  if ( ( d = segmentDistance2 ( P[i], P[a], P[b] ) ) > Far ) {
+		Far = d;
+		Farthest = i;
+	  }
+	if ( Far <= Tolerance2 ) continue;
+
+	Keep[Farthest] = 1;
+	Todo.push_back ( make_pair ( a, Farthest ) );
+	Todo.push_back ( make_pair ( Farthest, b ) );
+  }
+
+  // no gap between kept points longer than the resolution, if we can
+  if ( D.Resolution )
+	for ( k = 0, i = 1; i + 1 < P.size (); i++ ) {
+	  if ( ! Keep[i] && P[i + 1].Time - P[k].Time > D.Resolution ) Keep[i] = 1;
+	  if ( Keep[i] ) k = i;
+	}
+
+  for ( i = 1; i < P.size (); i++ ) {
+	if ( ! Keep[i] ) continue;
+	emitDelay ( D, P[i].Time );
+	emit ( D, OpMotionNotify, P[i].x, P[i].y );
+	D.DragKept++;
+  }
+  P.clear ();
+}
+
+/****************************************************************************/
+/*! Emits the key event \a Op of the keycode \a kc: by the name of its keysym,
+    or as the keycode if it has none.
+*/
+/****************************************************************************/
+static void emitKey (EventDecoder & D, int Op, KeyCode kc) {
+
+  KeySym ks = keycodeToKeysym ( *D.Keys, kc, 0 );
+
+  if ( ks != NoSymbol ) emit ( D, Op, ks, 0 );
+  else emit ( D, Op == OpKeyStrPress ? OpKeyCodePress : OpKeyCodeRelease, kc, 0 );
+}
+
+/****************************************************************************/
+/*! Decodes the protocol event at \a Data as recorded from the server and
+    emits the macro events for it. Returns DecodeQuit or DecodeCheckpoint if
+	it was a press of one of those keys; the caller sets the checkpoint with
+	decodeCheckpoint(), the held back motion has been emitted.
+
+	\arg EventDecoder & D - the decoder.
+	\arg const unsigned char * Data - the 32 bytes of the event.
+*/
+/****************************************************************************/
+int decodeEvent (EventDecoder & D, const unsigned char * Data) {
+
+  uint32_t ud4[2];
+  int16_t d2[2];
+  int type, detail, rootx, rooty;
+
+  memcpy ( ud4, Data, sizeof (ud4) );
+  memcpy ( d2, Data + 20, sizeof (d2) );
+  type = Data[0] & 0x7F;
+  detail = Data[1];
+  rootx = d2[0];
+  rooty = d2[1];
+  D.Time = ud4[1];
+
+  if ( D.Status1 ) {
+	D.Status1--;
+	if ( type == KeyRelease ) {
+	  trace ( TraceInfo, 0, "Skipping stale KeyRelease event", TraceOneArg, D.Status1 );
+	  return DecodeDone;
+	}
+	else D.Status1 = 0;
+  }
+  if ( D.x == -1 && D.y == -1 && D.mmoved == 0 && type != MotionNotify ) {
+	trace ( TraceWarn, 0, "Please move the mouse before any other event to synchronize "
+			"pointer coordinates! This event is now ignored!" );
+	return DecodeDone;
+  }
+  trace ( TraceEvent, 0, "Recorded", TraceTwoArgs, type, detail );
+
+  // a drag being simplified ends with any other event
+  if ( type != MotionNotify && ! D.Drag.empty () ) emitDrag ( D );
+
+  // what did we get?
+  switch ( type ) {
+	case ButtonPress:
+	  // button pressed, create event
+	  emitMotion ( D );
+	  if ( D.Status2 < 0 ) D.Status2 = 0;
+	  D.Status2++;
+	  emitDelay ( D, D.Time );
+	  emit ( D, OpButtonPress, detail, 0 );
+	  break;
+
+	case ButtonRelease:
+	  // button released, create event
+	  emitMotion ( D );
+	  D.Status2--;
+	  if ( D.Status2 < 0 ) D.Status2 = 0;
+	  emitDelay ( D, D.Time );
+	  emit ( D, OpButtonRelease, detail, 0 );
+	  break;
+
+	case MotionNotify:
+	  // motion-event, only kept while a button is down
+	  if ( D.Status2 > 0 && D.Tolerance ) {
+		if ( D.Drag.empty () ) D.Drag.push_back ( MotionPoint { D.x, D.y, D.Time } );
+		D.Drag.push_back ( MotionPoint { rootx, rooty, D.Time } );
+		D.DragPoints++;
+		D.mmoved = 0;
+	  }
+	  else if ( D.Status2 > 0 ) {
+		emitDelay ( D, D.Time );
+		emit ( D, OpMotionNotify, rootx, rooty );
+		D.mmoved = 0;
+	  }
+	  else D.mmoved = 1;
+	  D.x = rootx;
+	  D.y = rooty;
+	  D.mtime = D.Time;
+	  break;
+
+	case KeyPress:
+	  // a key was pressed, should we stop or set a checkpoint?
+	  if ( detail == (int) D.QuitKey ) return DecodeQuit;
+	  // the pointer must be where the event happened
+	  emitMotion ( D );
+	  if ( detail == (int) D.CheckKey ) return DecodeCheckpoint;
+	  emitDelay ( D, D.Time );
+	  emitKey ( D, OpKeyStrPress, detail );
+	  break;
+
+	case KeyRelease:
+	  // a key was released
+	  if ( detail == (int) D.CheckKey ) break;
+	  emitMotion ( D );
+	  emitDelay ( D, D.Time );
+	  emitKey ( D, OpKeyStrRelease, detail );
+	  break;
+  }
+
+  return DecodeDone;
+}
+
+/****************************************************************************/
+/*! Emits a checkpoint set at server time \a Time: a WaitForPixels at \a x,
+    \a y for \a Region. The wait takes the place of the delay before it.
+*/
+/****************************************************************************/
+void decodeCheckpoint (EventDecoder & D, uint32_t Time, int x, int y, const MacroRegion & Region) {
+
+  MacroEvent ev;
+
+  if ( ! D.Drag.empty () ) emitDrag ( D );
+  emitMotion ( D );
+  if ( D.Timing ) D.LastTime = Time;
+
+  memset ( &ev, 0, sizeof (ev) );
+  ev.Op = OpWaitForPixels;
+  ev.Len = sizeof (Region);
+  ev.A = x;
+  ev.B = y;
+  D.Emit ( D.Arg, ev, (const char *) &Region );
+}
+
+/****************************************************************************/
+/*! Decodes the capture record \a r: emits the events of recorded data and
+    checkpoints and applies the keyboard mapping records to \a Map. Returns
+	false if the record is broken.
+*/
+/****************************************************************************/
+bool decodeRecord (EventDecoder & D, const CaptureRecord & r, KeyMap & Map) {
+
+  int32_t At[2];
+  MacroRegion Region;
+
+  switch ( r.Kind ) {
+	case XRecordFromServer:
+	  if ( r.Len < CaptureDataSize ) return false;
+	  if ( r.Swapped ) trace ( TraceWarn, 0, "Client is swapped!!!" );
+	  decodeEvent ( D, r.Data );
+	  return true;
+
+	case XRecordStartOfData:
+	  trace ( TraceInfo, 0, "Got Start Of Data" );
+	  return true;
+
+	case XRecordEndOfData:
+	  trace ( TraceInfo, 0, "Got End Of Data" );
+	  return true;
+
+	case CaptureKeyMap:
+	case CaptureKeySyms:
+	  return readCaptureKeyMap ( r, Map );
+
+	case CaptureCheckpoint:
+	  if ( r.Len < sizeof (At) + sizeof (Region) ) return false;
+	  memcpy ( At, r.Data, sizeof (At) );
+	  memcpy ( &Region, r.Data + sizeof (At), sizeof (Region) );
+	  decodeCheckpoint ( D, r.Time, At[0], At[1], Region );
+	  return true;
+  }
+
+  trace ( TraceDebug, 0, "Skipping category", TraceOneArg, r.Kind );
+  return true;
+}
+
+/****************************************************************************/
+/*! Emits what the decoder still holds back when the recording ends, i.e. a
+    drag in progress.
+*/
+/****************************************************************************/
+void finishDecoder (EventDecoder & D) {
+
+  if ( ! D.Drag.empty () ) emitDrag ( D );
+}
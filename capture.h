@@ -0,0 +1,129 @@
+/*****************************************************************************
+ *
+ * capture.h is the raw capture format of xmacrorec2 and the decoder turning
+ * recorded protocol events into macro events
+ *
+ * A raw capture keeps what the RECORD extension handed to xmacrorec2 as it
+ * came, so nothing is decoded or formatted while recording; xmacrodecode
+ * turns it into a macro later. The same decoder does it for xmacrorec2
+ * when it records a macro directly.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_CAPTURE_H
+#define XMACRO_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include "macro.h"
+#include "keymap.h"
+
+/*****************************************************************************
+ * A capture is a CaptureHeader followed by CaptureRecords of a fixed size,
+ * so they can be written straight from the slots they were collected in.
+ * A record holds one protocol event (32 bytes) or a piece of the keyboard
+ * mapping or a checkpoint. Everything is in host byte order.
+ ****************************************************************************/
+#define CAPTURE_MAGIC "XRAW"
+
+const uint16_t CaptureVersion   = 1;
+const uint16_t CaptureByteOrder = 0x0102;
+const size_t   CaptureDataSize  = 32;
+const size_t   CaptureSymsSize  = 7;	// keysyms in a CaptureKeySyms record
+
+enum CaptureKind {
+  // below CaptureKeyMap the kind is the XRecord category of the data
+  CaptureKeyMap = 16,		// starts a mapping: MinCode, MaxCode, PerCode
+  CaptureKeySyms,			// Code, First, Count and Count keysyms from First
+  CaptureCheckpoint			// x, y and the MacroRegion of a WaitForPixels
+};
+
+struct CaptureHeader {
+  char     Magic[4];
+  uint16_t Version;
+  uint16_t ByteOrder;
+  int32_t  PointerX, PointerY;	// where the pointer was at the start
+};
+
+struct CaptureRecord {
+  uint32_t Time;				// server time
+  uint8_t  Kind;
+  uint8_t  Swapped;				// client_swapped of the data
+  uint8_t  Len;					// bytes used of Data
+  uint8_t  Reserved;
+  uint8_t  Data[CaptureDataSize];
+};
+
+/*****************************************************************************
+ * A point of the pointer path while a button is held down.
+ ****************************************************************************/
+struct MotionPoint {
+  int32_t  x, y;
+  uint32_t Time;
+};
+
+/*****************************************************************************
+ * The Resolution of simplified drags the tools default to, in ms
+ ****************************************************************************/
+const uint32_t DefaultResolution = 100;
+
+/*****************************************************************************
+ * The state of decoding recorded events into macro events. The pointer
+ * motion between other events is coalesced into the last position, only
+ * while a button is down every motion is kept. With a Tolerance the path
+ * of such a drag is collected and simplified when it ends: only the points
+ * needed to keep it within Tolerance pixels are emitted, and with a
+ * Resolution at least one every Resolution ms, so the pace of the drag is
+ * kept too. Decoded events are handed to Emit with their payload.
+ ****************************************************************************/
+struct EventDecoder {
+  int              Status1, Status2, x, y, mmoved;
+  bool             Timing;				// emit Delay events
+  unsigned int     QuitKey, CheckKey;	// 0 for none
+  uint32_t         Time, LastTime, mtime;
+  const KeyMap *   Keys;
+  void          (* Emit) (void * Arg, const MacroEvent & ev, const char * Payload);
+  void *           Arg;
+  int              Tolerance;			// in pixels, 0 keeps every point
+  uint32_t         Resolution;			// in ms, 0 for none
+  std::vector<MotionPoint> Drag;		// starts where the drag started
+  unsigned long    DragPoints, DragKept;
+};
+
+/*****************************************************************************
+ * What decodeEvent() found, besides the events it emitted.
+ ****************************************************************************/
+enum DecodeResult {
+  DecodeDone = 0,
+  DecodeQuit,				// the quit key was pressed
+  DecodeCheckpoint			// the checkpoint key was pressed
+};
+
+void beginCapture (CaptureHeader & h, int x, int y);
+bool checkCapture (const CaptureHeader & h);
+void captureKeyMap (const KeyMap & Map, std::vector<CaptureRecord> & Out);
+void captureCheckpoint (CaptureRecord & r, uint32_t Time, int x, int y, const MacroRegion & Region);
+bool readCaptureKeyMap (const CaptureRecord & r, KeyMap & Map);
+
+void startDecoder (EventDecoder & D, int x, int y, bool Timing);
+int  decodeEvent (EventDecoder & D, const unsigned char * Data);
+void decodeCheckpoint (EventDecoder & D, uint32_t Time, int x, int y, const MacroRegion & Region);
+bool decodeRecord (EventDecoder & D, const CaptureRecord & r, KeyMap & Map);
+void finishDecoder (EventDecoder & D);
+
+#endif
@@ -0,0 +1,563 @@
+/*****************************************************************************
+ *
+ * keymap.cpp - the client side keyboard map cache of the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/XKBlib.h>
+
+#include "chartbl.h"
+#include "keymap.h"
+
+/****************************************************************************/
+/*! Hashes the keysym \a ks into a table of \a Mask + 1 slots.
+*/
+/****************************************************************************/
+static inline size_t hashKeySym (KeySym ks, size_t Mask) {
+
+  return (size_t)( ( (uint64_t) ks * 0x9E3779B97F4A7C15ULL ) >> 32 ) & Mask;
+}
+
+/****************************************************************************/
+/*! Returns the keysym in column \a Column of keycode \a kc. Follows the rules
+    of \c XKeycodeToKeysym, including the implicit upper case symbol of keys
+	that only list the lower case one.
+
+	\arg const KeyMap & Map - the cached mapping.
+	\arg KeyCode kc - the keycode.
+	\arg int Column - index into the symbols of the keycode.
+*/
+/****************************************************************************/
+KeySym keycodeToKeysym (const KeyMap & Map, KeyCode kc, int Column) {
+
+  int Per = Map.PerCode;
+  const KeySym * Syms;
+  KeySym Lower, Upper;
+
+  if ( Column < 0 || ( Column >= Per && Column > 3 )
+	   || kc < Map.MinCode || kc > Map.MaxCode )
+	return NoSymbol;
+
+  Syms = &Map.Syms[ ( kc - Map.MinCode ) * Map.PerCode ];
+  if ( Column < 4 ) {
+	if ( Column > 1 ) {
+	  while ( Per > 2 && Syms[Per - 1] == NoSymbol ) Per--;
+	  if ( Per < 3 ) Column -= 2;
+	}
+	if ( Per <= ( Column | 1 ) || Syms[Column | 1] == NoSymbol ) {
+	  XConvertCase ( Syms[Column & ~1], &Lower, &Upper );
+	  if ( ! ( Column & 1 ) ) return Lower;
+	  return Upper == Lower ? NoSymbol : Upper;
+	}
+  }
+
+  return Syms[Column];
+}
+
+/****************************************************************************/
+/*! Collects the keycodes of \a Map that have no symbols as spare keys.
+    Spares we have bound before stay in the pool (with their use) as long as
+	the keycode still holds just the bound keysym.
+*/
+/****************************************************************************/
+static void findSpares (KeyMap & Map) {
+
+  std::vector<SpareKey> Old;
+  const KeySym * Syms;
+  SpareKey Spare;
+  size_t i;
+  int kc, Column;
+
+  Old.swap ( Map.Spares );
+  for ( kc = Map.MinCode; kc <= Map.MaxCode && Map.PerCode; kc++ ) {
+	Syms = &Map.Syms[ ( kc - Map.MinCode ) * Map.PerCode ];
+	Spare.Code  = kc;
+	Spare.Sym   = NoSymbol;
+	Spare.Stamp = 0;
+
+	for ( i = 0; i < Old.size (); i++ )
+	  if ( Old[i].Code == kc && Old[i].Sym == Syms[0] ) Spare = Old[i];
+
+	for ( Column = 0; Column < Map.PerCode; Column++ )
+	  if ( Syms[Column] != NoSymbol && Syms[Column] != Spare.Sym ) break;
+	if ( Column == Map.PerCode ) Map.Spares.push_back ( Spare );
+  }
+}
+
+/****************************************************************************/
+/*! Tells the \a Group and \a Level of the core mapping column \a Column.
+*/
+/****************************************************************************/
+static void columnLevel (int Column, unsigned char & Group, unsigned char & Level) {
+
+  if ( Column < 8 ) {
+	Group = Column / 2 % 2;
+	Level = Column % 2 + ( Column < 4 ? 0 : 2 );
+  }
+  else {
+	Group = 2;
+	Level = 0;
+  }
+}
+
+/****************************************************************************/
+/*! Rebuilds the keysym hash table of \a Map from its cached mapping. The
+    columns of group 1 win over the others, then the first column, then the
+	lowest keycode, as in \c XKeysymToKeycode.
+*/
+/****************************************************************************/
+static void buildTable (KeyMap & Map) {
+
+  size_t Size = 64, Mask, i;
+  int kc, Column, Pass;
+  unsigned char Group, Level;
+  KeySym ks;
+
+  while ( Size < Map.Syms.size () * 2 ) Size <<= 1;
+  Mask = Size - 1;
+
+  Map.Table.assign ( Size, KeyMapEntry () );
+  for ( Pass = 0; Pass < 2; Pass++ ) {
+	// group 1 first, the other groups only fill in what it lacks
+	for ( Column = 0; Column < Map.PerCode; Column++ ) {
+	  columnLevel ( Column, Group, Level );
+	  if ( ( Group != 0 ) != ( Pass != 0 ) ) continue;
+
+	  for ( kc = Map.MinCode; kc <= Map.MaxCode; kc++ ) {
+		if ( ( ks = keycodeToKeysym ( Map, kc, Column ) ) == NoSymbol ) continue;
+
+		for ( i = hashKeySym ( ks, Mask ); Map.Table[i].Sym != NoSymbol;
+			  i = ( i + 1 ) & Mask )
+		  if ( Map.Table[i].Sym == ks ) break;
+		if ( Map.Table[i].Sym == ks ) continue;
+
+		Map.Table[i].Sym    = ks;
+		Map.Table[i].Code   = kc;
+		Map.Table[i].Column = Column;
+		Map.Table[i].Group  = Group;
+		Map.Table[i].Level  = Level;
+	  }
+	}
+  }
+
+  Map.ShiftCode = keysymToKeycode ( Map, XK_Shift_L );
+  Map.Level3Code = keysymToKeycode ( Map, XK_ISO_Level3_Shift );
+  findSpares ( Map );
+  Map.Changes++;
+}
+
+/****************************************************************************/
+/*! Fetches the complete keyboard mapping of \a Dpy in a single request and
+    builds the lookup table of \a Map from it.
+
+    \arg Display * Dpy - used display.
+	\arg KeyMap & Map - receives the mapping.
+*/
+/****************************************************************************/
+void loadKeyMap (Display * Dpy, KeyMap & Map) {
+
+  KeySym * Syms;
+  int Count;
+
+  XDisplayKeycodes ( Dpy, &Map.MinCode, &Map.MaxCode );
+  Count = Map.MaxCode - Map.MinCode + 1;
+
+  Syms = XGetKeyboardMapping ( Dpy, Map.MinCode, Count, &Map.PerCode );
+  if ( ! Syms ) Map.PerCode = 0;
+  Map.Syms.assign ( Syms, Syms + Count * Map.PerCode );
+  if ( Syms ) XFree ( Syms );
+
+  buildTable ( Map );
+}
+
+/****************************************************************************/
+/*! Returns where the keysym \a ks is found on the keyboard, or 0 if it is
+    not mapped at all.
+*/
+/****************************************************************************/
+const KeyMapEntry * lookupKeySym (const KeyMap & Map, KeySym ks) {
+
+  size_t Mask = Map.Table.size () - 1, i;
+
+  if ( ks == NoSymbol || Map.Table.empty () ) return 0;
+
+  for ( i = hashKeySym ( ks, Mask ); Map.Table[i].Sym != NoSymbol;
+		i = ( i + 1 ) & Mask )
+	if ( Map.Table[i].Sym == ks ) return &Map.Table[i];
+
+  return 0;
+}
+
+/****************************************************************************/
+/*! Fetches the mapping of the \a Count keycodes starting at \a First again,
+    e.g. after a MappingNotify, and updates \a Map. Only the changed range
+	is requested from the server; the hash table is rebuilt from the cache.
+
+    \arg Display * Dpy - used display.
+	\arg KeyMap & Map - the cached mapping.
+	\arg int First - the first changed keycode.
+	\arg int Count - the number of changed keycodes.
+*/
+/****************************************************************************/
+void updateKeyMap (Display * Dpy, KeyMap & Map, int First, int Count) {
+
+  KeySym * Syms;
+  int Per;
+
+  if ( First < Map.MinCode ) {
+	Count -= Map.MinCode - First;
+	First = Map.MinCode;
+  }
+  if ( First + Count - 1 > Map.MaxCode ) Count = Map.MaxCode - First + 1;
+  if ( Count <= 0 ) return;
+
+  Syms = XGetKeyboardMapping ( Dpy, First, Count, &Per );
+  if ( ! Syms ) return;
+
+  if ( Per != Map.PerCode ) {
+	// the shape of the mapping changed, start over
+	XFree ( Syms );
+	loadKeyMap ( Dpy, Map );
+	return;
+  }
+
+  std::copy ( Syms, Syms + Count * Per,
+			  Map.Syms.begin () + ( First - Map.MinCode ) * Per );
+  XFree ( Syms );
+
+  buildTable ( Map );
+}
+
+/****************************************************************************/
+/*! Asks for the events announcing keyboard mapping changes on \a Dpy. Core
+    MappingNotify events are always delivered; if the server has XKB its
+	map notifications are selected too, as XKB aware clients may not get
+	the core ones.
+*/
+/****************************************************************************/
+void selectKeyMapEvents (Display * Dpy, KeyMap & Map) {
+
+  int Opcode, Error, Major = XkbMajorVersion, Minor = XkbMinorVersion;
+
+  if ( ! XkbQueryExtension ( Dpy, &Opcode, &Map.XkbEvent, &Error, &Major, &Minor ) ) {
+	Map.XkbEvent = -1;
+	return;
+  }
+
+  XkbSelectEventDetails ( Dpy, XkbUseCoreKbd, XkbMapNotify,
+						  XkbKeySymsMask, XkbKeySymsMask );
+  XkbSelectEventDetails ( Dpy, XkbUseCoreKbd, XkbNewKeyboardNotify,
+						  XkbNKN_KeycodesMask, XkbNKN_KeycodesMask );
+}
+
+/****************************************************************************/
+/*! Updates \a Map if \a Event announces a change of the keyboard mapping.
+    Returns true if the event was a mapping event.
+*/
+/****************************************************************************/
+bool handleKeyMapEvent (Display * Dpy, KeyMap & Map, XEvent & Event) {
+
+  if ( Event.type == MappingNotify ) {
+	if ( Event.xmapping.request == MappingKeyboard )
+	  updateKeyMap ( Dpy, Map, Event.xmapping.first_keycode, Event.xmapping.count );
+	else if ( Event.xmapping.request == MappingModifier )
+	  XRefreshKeyboardMapping ( &Event.xmapping );
+	return true;
+  }
+
+  if ( Map.XkbEvent >= 0 && Event.type == Map.XkbEvent ) {
+	XkbEvent * xkb = (XkbEvent *) &Event;
+
+	if ( xkb->any.xkb_type == XkbMapNotify ) {
+	  if ( xkb->map.changed & XkbKeySymsMask )
+		updateKeyMap ( Dpy, Map, xkb->map.first_key_sym, xkb->map.num_key_syms );
+	}
+	else if ( xkb->any.xkb_type == XkbNewKeyboardNotify ) loadKeyMap ( Dpy, Map );
+	return true;
+  }
+
+  return false;
+}
+
+/****************************************************************************/
+/*! Handles the mapping events that have arrived on \a Dpy so far, without
+    blocking and without flushing the output buffer. Other events are
+	dropped.
+*/
+/****************************************************************************/
+void processKeyMapEvents (Display * Dpy, KeyMap & Map) {
+
+  XEvent Event;
+
+  while ( XEventsQueued ( Dpy, QueuedAfterReading ) ) {
+	XNextEvent ( Dpy, &Event );
+	handleKeyMapEvent ( Dpy, Map, Event );
+  }
+}
+
+/****************************************************************************/
+/*! Makes sure the keysyms \a Syms can be typed on \a Dpy. Keysyms missing
+    from group 1 of the mapping are bound to spare keycodes, reusing the
+	least recently used ones, but never one needed by an earlier keysym of
+	\a Syms. All bindings go to the server in a single XChangeKeyboardMapping
+	request, as every change makes all clients fetch the mapping again.
+	Returns how many keysyms from the start of \a Syms are ready; keysyms
+	that can not be bound at all (there are no spares) count as ready and
+	fail when typed.
+
+    \arg Display * Dpy - used display.
+	\arg KeyMap & Map - the cached mapping.
+	\arg const KeySym * Syms - the keysyms about to be typed.
+	\arg size_t Count - the number of keysyms.
+*/
+/****************************************************************************/
+size_t bindKeySyms (Display * Dpy, KeyMap & Map, const KeySym * Syms, size_t Count) {
+
+  int First = Map.MaxCode + 1, Last = Map.MinCode - 1, Column;
+  const KeyMapEntry * e;
+  SpareKey * Spare;
+  KeySym * Code;
+  bool Bound;
+  size_t n, i;
+
+  Map.Clock++;
+  for ( n = 0; n < Count; n++ ) {
+	if ( Syms[n] == NoSymbol ) continue;
+
+	// already bound? then keep it from being taken for another keysym
+	Bound = false;
+	for ( i = 0; i < Map.Spares.size (); i++ )
+	  if ( Map.Spares[i].Sym == Syms[n] ) {
+		Map.Spares[i].Stamp = Map.Clock;
+		Bound = true;
+	  }
+	if ( Bound || Map.Spares.empty () ) continue;
+
+	// the table is only rebuilt at the end, it may still list a keysym on
+	// a spare we have just lent to another one
+	e = lookupKeySym ( Map, Syms[n] );
+	if ( e && ! e->Group && keycodeToKeysym ( Map, e->Code, e->Column ) == Syms[n] )
+	  continue;
+
+	Spare = 0;
+	for ( i = 0; i < Map.Spares.size (); i++ )
+	  if ( Map.Spares[i].Stamp != Map.Clock
+		   && ( ! Spare || Map.Spares[i].Stamp < Spare->Stamp ) )
+		Spare = &Map.Spares[i];
+	if ( ! Spare ) break;
+
+	// the same symbol with and without shift
+	Spare->Sym = Syms[n];
+	Spare->Stamp = Map.Clock;
+	Code = &Map.Syms[ ( Spare->Code - Map.MinCode ) * Map.PerCode ];
+	for ( Column = 0; Column < Map.PerCode; Column++ )
+	  Code[Column] = Column < 2 ? Syms[n] : NoSymbol;
+
+	First = std::min ( First, (int) Spare->Code );
+	Last = std::max ( Last, (int) Spare->Code );
+	Map.Remaps++;
+  }
+
+  if ( First <= Last ) {
+	buildTable ( Map );
+	XChangeKeyboardMapping ( Dpy, First, Map.PerCode,
+							 &Map.Syms[ ( First - Map.MinCode ) * Map.PerCode ],
+							 Last - First + 1 );
+	Map.RemapRequests++;
+  }
+
+  return n;
+}
+
+/****************************************************************************/
+/*! Gives the spare keycodes bound by bindKeySyms() their empty mapping back.
+*/
+/****************************************************************************/
+void releaseSpareKeys (Display * Dpy, KeyMap & Map) {
+
+  int First = Map.MaxCode + 1, Last = Map.MinCode - 1, Column;
+  KeySym * Code;
+  size_t i;
+
+  for ( i = 0; i < Map.Spares.size (); i++ ) {
+	if ( Map.Spares[i].Sym == NoSymbol ) continue;
+
+	Code = &Map.Syms[ ( Map.Spares[i].Code - Map.MinCode ) * Map.PerCode ];
+	for ( Column = 0; Column < Map.PerCode; Column++ ) Code[Column] = NoSymbol;
+	Map.Spares[i].Sym = NoSymbol;
+
+	First = std::min ( First, (int) Map.Spares[i].Code );
+	Last = std::max ( Last, (int) Map.Spares[i].Code );
+  }
+
+  if ( First > Last ) return;
+
+  XChangeKeyboardMapping ( Dpy, First, Map.PerCode,
+						   &Map.Syms[ ( First - Map.MinCode ) * Map.PerCode ],
+						   Last - First + 1 );
+  buildTable ( Map );
+}
+
+/****************************************************************************/
+/*! Decodes the UTF-8 character at \a p, not reading past \a End, and moves
+    \a p behind it. Bytes that are not valid UTF-8 are taken as Latin-1
+	characters, as macros used to be written in Latin-1.
+*/
+/****************************************************************************/
+uint32_t decodeUtf8 (const unsigned char *& p, const unsigned char * End) {
+
+  uint32_t c = *p, Min;
+  int More, i;
+
+  if ( c < 0x80 ) { p++; return c; }
+  else if ( ( c & 0xE0 ) == 0xC0 ) { More = 1; Min = 0x80;    c &= 0x1F; }
+  else if ( ( c & 0xF0 ) == 0xE0 ) { More = 2; Min = 0x800;   c &= 0x0F; }
+  else if ( ( c & 0xF8 ) == 0xF0 ) { More = 3; Min = 0x10000; c &= 0x07; }
+  else return *p++;
+
+  if ( End - p <= More ) return *p++;
+  for ( i = 1; i <= More; i++ ) {
+	if ( ( p[i] & 0xC0 ) != 0x80 ) return *p++;
+	c = ( c << 6 ) | ( p[i] & 0x3F );
+  }
+  if ( c < Min || c > 0x10FFFF || ( c >= 0xD800 && c <= 0xDFFF ) ) return *p++;
+
+  p += More + 1;
+  return c;
+}
+
+/****************************************************************************/
+/*! Returns the keysym typing the Unicode character \a c on \a Map. Latin-1
+    goes through the character table. Other characters are typed with their
+	legacy keysym (EuroSign, ccaron, Cyrillic_a...) if group 1 has it,
+	else with their Unicode keysym, which is bound to a spare if need be.
+*/
+/****************************************************************************/
+KeySym charToKeysym (const KeyMap & Map, uint32_t c) {
+
+  const UcsKeySym * u, * End = chartbl_ucs + sizeof (chartbl_ucs) / sizeof (chartbl_ucs[0]);
+  const KeyMapEntry * e;
+
+  if ( c < 0x100 ) return chartbl_lat1[c];
+
+  u = std::lower_bound ( chartbl_ucs, End, c,
+						 [] ( const UcsKeySym & e, uint32_t c ) { return e.Ucs < c; } );
+  if ( u != End && u->Ucs == c && ( e = lookupKeySym ( Map, u->Sym ) ) && ! e->Group )
+	return u->Sym;
+
+  return 0x01000000 | c;
+}
+
+/****************************************************************************/
+/*! Returns the fingerprint of the mapping of \a Map: a 64 bit FNV-1a hash of
+    the keycode range and the keysyms of every keycode, up to its last one.
+	It is the same whether the mapping was fetched or read from a dump, as
+	a dump leaves out the empty columns at the end. The spare keycodes count
+	as empty, whatever bindKeySyms() lent them to for now.
+*/
+/****************************************************************************/
+uint64_t keyMapFingerprint (const KeyMap & Map) {
+
+  uint64_t h = 0xcbf29ce484222325ULL;
+  const KeySym * Syms;
+  bool Spare[256] = { false };
+  int kc, Count, i;
+  size_t j;
+
+  auto mix = [&h] ( uint32_t w ) {
+	for ( int b = 0; b < 32; b += 8 ) h = ( h ^ ( ( w >> b ) & 0xff ) ) * 0x100000001b3ULL;
+  };
+
+  for ( j = 0; j < Map.Spares.size (); j++ ) Spare[Map.Spares[j].Code] = true;
+
+  mix ( Map.MinCode );
+  mix ( Map.MaxCode );
+
+  for ( kc = Map.MinCode; kc <= Map.MaxCode; kc++ ) {
+	Syms = Map.PerCode ? &Map.Syms[ ( kc - Map.MinCode ) * Map.PerCode ] : 0;
+	Count = Spare[kc] ? 0 : Map.PerCode;
+	while ( Count > 0 && Syms[Count - 1] == NoSymbol ) Count--;
+	mix ( Count );
+	for ( i = 0; i < Count; i++ ) mix ( (uint32_t) Syms[i] );
+  }
+
+  return h;
+}
+
+/****************************************************************************/
+/*! Reads a keyboard mapping dumped by 'xmodmap -pke' from \a Path into
+    \a Map, instead of fetching it from a display. Only the lines starting
+	with "keycode" are used. Returns false if the file can't be read or
+	holds no keycodes.
+
+    \arg const char * Path - the dump.
+	\arg KeyMap & Map - receives the mapping.
+*/
+/****************************************************************************/
+bool readKeyMapDump (const char * Path, KeyMap & Map) {
+
+  std::vector< std::pair<int, std::vector<KeySym> > > Codes;
+  FILE * f = fopen ( Path, "r" );
+  char * Line = 0, * Name, * Rest;
+  size_t Size = 0;
+  int kc, Used;
+  KeySym ks;
+
+  if ( ! f ) return false;
+
+  Map.MinCode = 255;
+  Map.MaxCode = 0;
+  Map.PerCode = 0;
+  while ( getline ( &Line, &Size, f ) > 0 ) {
+	if ( sscanf ( Line, " keycode %d =%n", &kc, &Used ) != 1 || kc < 8 || kc > 255 ) continue;
+
+	Codes.push_back ( std::make_pair ( kc, std::vector<KeySym> () ) );
+	for ( Name = strtok_r ( Line + Used, " \t\r\n", &Rest ); Name;
+		  Name = strtok_r ( 0, " \t\r\n", &Rest ) ) {
+	  // keysyms without a name are dumped as numbers
+	  if ( ( ks = XStringToKeysym ( Name ) ) == NoSymbol && strcmp ( Name, "NoSymbol" ) )
+		ks = strtoul ( Name, 0, 0 );
+	  Codes.back ().second.push_back ( ks );
+	}
+
+	Map.MinCode = std::min ( Map.MinCode, kc );
+	Map.MaxCode = std::max ( Map.MaxCode, kc );
+	Map.PerCode = std::max ( Map.PerCode, (int) Codes.back ().second.size () );
+  }
+  free ( Line );
+  fclose ( f );
+
+  if ( Codes.empty () ) return false;
+
+  Map.Syms.assign ( ( Map.MaxCode - Map.MinCode + 1 ) * Map.PerCode, NoSymbol );
+  for ( size_t i = 0; i < Codes.size (); i++ )
+	std::copy ( Codes[i].second.begin (), Codes[i].second.end (),
+				Map.Syms.begin () + ( Codes[i].first - Map.MinCode ) * Map.PerCode );
+
+  buildTable ( Map );
+  return true;
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+ *
+ * keymap.h is the client side keyboard map cache of the xmacro utilities
+ *
+ * Holds a copy of the keyboard mapping of a display, fetched once, and a
+ * keysym to keycode hash table built from it, so keysyms and keycodes can
+ * be converted without talking to the server. Changes of the mapping are
+ * picked up from MappingNotify (and XkbMapNotify) events.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_KEYMAP_H
+#define XMACRO_KEYMAP_H
+
+#include <stdint.h>
+#include <vector>
+#include <X11/Xlib.h>
+
+/*****************************************************************************
+ * Where a keysym lives on the keyboard. Column is the index in the core
+ * keyboard mapping; Group and Level are derived from it the way XKB lays
+ * out the core mapping (columns 0-3 are group 1/2 at level 1/2, columns
+ * 4-7 the same at level 3/4, e.g. AltGr). Later columns are taken as
+ * group 3. Only group 1 can be typed: we don't switch groups, so a keysym
+ * found in another one counts as missing when typing.
+ ****************************************************************************/
+struct KeyMapEntry {
+  KeySym        Sym;
+  KeyCode       Code;
+  unsigned char Column;
+  unsigned char Group;
+  unsigned char Level;
+};
+
+/*****************************************************************************
+ * A keycode without any symbols, lent to keysyms missing from the mapping.
+ * Stamp is when it was last used; the least recently used one is rebound
+ * when the pool runs out.
+ ****************************************************************************/
+struct SpareKey {
+  KeyCode       Code;
+  KeySym        Sym;		// NoSymbol while unused
+  unsigned long Stamp;
+};
+
+struct KeyMap {
+  int                      MinCode;
+  int                      MaxCode;
+  int                      PerCode;
+  std::vector<KeySym>      Syms;		// (MaxCode - MinCode + 1) * PerCode
+  std::vector<KeyMapEntry> Table;		// open addressing, power of two size
+  KeyCode                  ShiftCode;
+  KeyCode                  Level3Code;	// ISO_Level3_Shift, i.e. AltGr
+  int                      XkbEvent = -1;	// XKB event base, -1 without XKB
+  std::vector<SpareKey>    Spares;
+  unsigned long            Clock = 0;	// stamps the keysyms bound together
+  unsigned long            Remaps = 0, RemapRequests = 0;
+  unsigned long            Changes = 0;	// counts the (re)builds of the table
+};
+
+void loadKeyMap (Display * Dpy, KeyMap & Map);
+void updateKeyMap (Display * Dpy, KeyMap & Map, int First, int Count);
+void selectKeyMapEvents (Display * Dpy, KeyMap & Map);
+bool handleKeyMapEvent (Display * Dpy, KeyMap & Map, XEvent & Event);
+void processKeyMapEvents (Display * Dpy, KeyMap & Map);
+const KeyMapEntry * lookupKeySym (const KeyMap & Map, KeySym ks);
+KeySym keycodeToKeysym (const KeyMap & Map, KeyCode kc, int Column);
+size_t bindKeySyms (Display * Dpy, KeyMap & Map, const KeySym * Syms, size_t Count);
+void releaseSpareKeys (Display * Dpy, KeyMap & Map);
+uint64_t keyMapFingerprint (const KeyMap & Map);
+bool readKeyMapDump (const char * Path, KeyMap & Map);
+uint32_t decodeUtf8 (const unsigned char *& p, const unsigned char * End);
+KeySym charToKeysym (const KeyMap & Map, uint32_t c);
+
+/****************************************************************************/
+/*! Returns the keycode producing \a ks on the display of \a Map, or 0 if
+    there is none. The same as \c XKeysymToKeycode, without the server.
+*/
+/****************************************************************************/
+inline KeyCode keysymToKeycode (const KeyMap & Map, KeySym ks) {
+
+  const KeyMapEntry * e = lookupKeySym ( Map, ks );
+
+  return e ? e->Code : 0;
+}
+
+#endif
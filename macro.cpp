@@ -0,0 +1,782 @@
+/*****************************************************************************
+ *
+ * macro.cpp - the macro language front end shared by the xmacro utilities.
+ *
+ * Parses the text macro language into MacroEvent records and reads and
+ * writes the compiled format described in macro.h.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <X11/Xlib.h>
+
+#include "macro.h"
+
+using namespace std;
+
+/*****************************************************************************
+ * Names of the commands, indexed by MacroOp.
+ ****************************************************************************/
+static constexpr const char * OpNames[] = {
+  "Nop", "Delay", "ButtonPress", "ButtonRelease", "MotionNotify",
+  "KeyCodePress", "KeyCodeRelease", "KeySym", "KeySymPress", "KeySymRelease",
+  "KeyStr", "KeyStrPress", "KeyStrRelease", "String", "Paste",
+  "WaitForWindow", "WaitForMap", "WaitForFocus", "WaitForIdle",
+  "WaitForPixels", "WaitForChange", "KeyMap", "Comment", "Unknown"
+};
+
+/****************************************************************************/
+/*! Returns the name of the command \a Op as used in the macro language.
+*/
+/****************************************************************************/
+const char * macroOpName (int Op) {
+
+  if ( Op < 0 || Op > OpUnknown ) return OpNames[OpUnknown];
+  return OpNames[Op];
+}
+
+/****************************************************************************/
+/*! Parses a duration like "2", "1.5", "250ms" or "40us" into whole seconds
+    \a Sec and microseconds \a Usec. A number without unit is in seconds.
+	Returns false if \a Text is not a valid duration.
+*/
+/****************************************************************************/
+bool parseDuration (const char * Text, int32_t & Sec, int32_t & Usec) {
+
+  char * Unit;
+  double Value = strtod ( Text, &Unit ), Scale;
+  long long Micro;
+
+  if ( Unit == Text || ! ( Value >= 0 ) ) return false;
+
+  if ( ! *Unit || ! strcmp ( Unit, "s" ) ) Scale = 1e6;
+  else if ( ! strcmp ( Unit, "ms" ) ) Scale = 1e3;
+  else if ( ! strcmp ( Unit, "us" ) ) Scale = 1;
+  else return false;
+
+  if ( Value * Scale / 1e6 >= INT32_MAX ) return false;
+  Micro = (long long)( Value * Scale + 0.5 );
+
+  Sec  = Micro / 1000000;
+  Usec = Micro % 1000000;
+  return true;
+}
+
+/*****************************************************************************
+ * Commands are dispatched through a perfect hash of their lower case name,
+ * built at compile time. If a new command collides, change TagSeed.
+ ****************************************************************************/
+const uint32_t TagSeed = 7;
+const unsigned int TagSlots = 64;
+
+static constexpr uint32_t tagHash (const char * Tag, size_t Len) {
+
+  uint32_t h = TagSeed;
+
+  for ( size_t i = 0; i < Len; i++ )
+	h = ( h ^ (uint8_t)( Tag[i] | 0x20 ) ) * 16777619u;
+  return h & ( TagSlots - 1 );
+}
+
+static constexpr size_t tagLength (const char * Tag) {
+
+  size_t Len = 0;
+
+  while ( Tag[Len] ) Len++;
+  return Len;
+}
+
+struct TagTable {
+  uint8_t Slot[TagSlots];
+  uint8_t Length[OpUnknown + 1];
+  bool    Perfect;
+};
+
+static constexpr TagTable makeTagTable () {
+
+  TagTable t = {};
+
+  t.Perfect = true;
+  for ( int Op = OpDelay; Op < OpComment; Op++ ) {
+	uint32_t h = tagHash ( OpNames[Op], tagLength ( OpNames[Op] ) );
+
+	if ( t.Slot[h] ) t.Perfect = false;
+	t.Slot[h] = Op;
+	t.Length[Op] = tagLength ( OpNames[Op] );
+  }
+  return t;
+}
+
+static constexpr TagTable Tags = makeTagTable ();
+static_assert ( Tags.Perfect, "command names collide in the tag hash, change TagSeed" );
+
+/****************************************************************************/
+/*! Returns the command named by the \a Len characters at \a Tag, ignoring
+    case, or OpUnknown.
+*/
+/****************************************************************************/
+static inline int lookupTag (const char * Tag, size_t Len) {
+
+  int Op = Tags.Slot[ tagHash ( Tag, Len ) ];
+
+  if ( Op && Tags.Length[Op] == Len && ! strncasecmp ( OpNames[Op], Tag, Len ) )
+	return Op;
+  return OpUnknown;
+}
+
+/****************************************************************************/
+/*! Prepares \a R to read the macro text open on \a Fd. Regular files are
+    mapped and parsed where they are, everything else is read in blocks.
+*/
+/****************************************************************************/
+void openMacroReader (MacroReader & R, int Fd) {
+
+  struct stat st;
+  void * Base;
+
+  R.Fd = Fd;
+  R.Pos = R.End = R.Mark = 0;
+  R.Eof = false;
+  R.Mapped = R.Borrowed = false;
+
+  if ( ! fstat ( Fd, &st ) && S_ISREG ( st.st_mode ) && st.st_size > 0 ) {
+	Base = mmap ( 0, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, Fd, 0 );
+	if ( Base != MAP_FAILED ) {
+	  madvise ( Base, st.st_size, MADV_SEQUENTIAL );
+	  R.Buf = (char *) Base;
+	  R.End = R.Cap = st.st_size;
+	  R.Mapped = R.Eof = true;
+	  return;
+	}
+  }
+
+  R.Cap = MacroReadBlock;
+  R.Buf = (char *) malloc ( R.Cap );
+}
+
+/****************************************************************************/
+/*! Prepares \a R to read the macro text in the \a Size bytes at \a Data.
+    The data must stay around while \a R is used.
+*/
+/****************************************************************************/
+void openMacroBuffer (MacroReader & R, const char * Data, size_t Size) {
+
+  R.Fd = -1;
+  R.Buf = (char *) Data;
+  R.Pos = R.Mark = 0;
+  R.End = R.Cap = Size;
+  R.Mapped = false;
+  R.Borrowed = R.Eof = true;
+}
+
+/****************************************************************************/
+/*! Releases what openMacroReader() set up. The descriptor stays open.
+*/
+/****************************************************************************/
+void closeMacroReader (MacroReader & R) {
+
+  if ( R.Mapped ) munmap ( R.Buf, R.Cap );
+  else if ( ! R.Borrowed ) free ( R.Buf );
+  R.Buf = 0;
+}
+
+/****************************************************************************/
+/*! Reads the next block of input. The command being parsed (from \c Mark on)
+    is moved to the start of the buffer first, \a Shift receives how far.
+	The buffer grows when one command does not fit. Returns false at the end
+	of the input.
+*/
+/****************************************************************************/
+static bool refill (MacroReader & R, size_t & Shift) {
+
+  ssize_t n;
+
+  Shift = 0;
+  if ( R.Eof ) return false;
+
+  if ( R.Mark ) {
+	Shift = R.Mark;
+	memmove ( R.Buf, R.Buf + R.Mark, R.End - R.Mark );
+	R.Pos -= Shift;
+	R.End -= Shift;
+	R.Mark = 0;
+  }
+
+  if ( R.End == R.Cap ) {
+	R.Cap *= 2;
+	R.Buf = (char *) realloc ( R.Buf, R.Cap );
+  }
+
+  do n = read ( R.Fd, R.Buf + R.End, R.Cap - R.End );
+  while ( n < 0 && errno == EINTR );
+
+  if ( n <= 0 ) {
+	R.Eof = true;
+	return false;
+  }
+
+  R.End += n;
+  return true;
+}
+
+static inline bool isBlank (char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/****************************************************************************/
+/*! Skips blanks (including line ends) and finds the next token, storing its
+    offset in \a Start and its length in \a Len. Returns false at the end of
+	the input.
+*/
+/****************************************************************************/
+static bool nextToken (MacroReader & R, size_t & Start, size_t & Len) {
+
+  size_t Shift;
+  bool More;
+
+  for ( ;; ) {
+	while ( R.Pos < R.End && isBlank ( R.Buf[R.Pos] ) ) R.Pos++;
+	if ( R.Pos < R.End ) break;
+	if ( ! refill ( R, Shift ) ) return false;
+  }
+
+  Start = R.Pos;
+  for ( ;; ) {
+	while ( R.Pos < R.End && ! isBlank ( R.Buf[R.Pos] ) ) R.Pos++;
+	if ( R.Pos < R.End ) break;
+	More = refill ( R, Shift );
+	Start -= Shift;
+	if ( ! More ) break;
+  }
+
+  Len = R.Pos - Start;
+  return true;
+}
+
+/****************************************************************************/
+/*! Finds the rest of the current line, storing its offset in \a Start and
+    its length (without the line end) in \a Len. The line end is consumed.
+*/
+/****************************************************************************/
+static void restOfLine (MacroReader & R, size_t & Start, size_t & Len) {
+
+  size_t Shift;
+  bool More;
+  const char * nl;
+
+  Start = R.Pos;
+  for ( ;; ) {
+	nl = (const char *) memchr ( R.Buf + R.Pos, '\n', R.End - R.Pos );
+	if ( nl ) {
+	  R.Pos = nl - R.Buf;
+	  break;
+	}
+	R.Pos = R.End;
+	More = refill ( R, Shift );
+	Start -= Shift;
+	if ( ! More ) break;
+  }
+
+  Len = R.Pos - Start;
+  if ( R.Pos < R.End ) R.Pos++;
+}
+
+/****************************************************************************/
+/*! Parses the next token as a decimal number into \a Value. Returns false
+    if there is no token or it is not a number.
+*/
+/****************************************************************************/
+static bool nextNumber (MacroReader & R, long long & Value) {
+
+  size_t Start, Len, i = 0;
+  bool Negative = false;
+
+  if ( ! nextToken ( R, Start, Len ) ) return false;
+
+  const char * t = R.Buf + Start;
+  if ( t[0] == '-' || t[0] == '+' ) Negative = t[i++] == '-';
+  if ( i == Len ) return false;
+
+  for ( Value = 0; i < Len; i++ ) {
+	if ( t[i] < '0' || t[i] > '9' ) return false;
+	Value = Value * 10 + ( t[i] - '0' );
+  }
+  if ( Negative ) Value = -Value;
+  return true;
+}
+
+/****************************************************************************/
+/*! Copies the next token into the name buffer of \a R as a C string.
+    Returns false if there is none or it is too long.
+*/
+/****************************************************************************/
+static bool nextName (MacroReader & R) {
+
+  size_t Start, Len;
+
+  if ( ! nextToken ( R, Start, Len ) || Len >= sizeof (R.Name) ) return false;
+  memcpy ( R.Name, R.Buf + Start, Len );
+  R.Name[Len] = 0;
+  return true;
+}
+
+/****************************************************************************/
+/*! Reads the next command from \a R and stores it in \a ev. \a Text is set
+    to the text belonging to the command: the String argument (\c ev.Len
+	bytes, pointing into the input and valid until the next call), the
+	MacroRegion of a WaitForPixels or WaitForChange (also \c ev.Len bytes)
+	or, as a C string, the keysym name of a KeyStr command, a comment or an unknown
+	tag. Returns false at the end of input.
+
+	\arg MacroReader & R - the macro text.
+	\arg MacroEvent & ev - the parsed command.
+	\arg const char *& Text - text belonging to the command.
+*/
+/****************************************************************************/
+bool readMacroEvent (MacroReader & R, MacroEvent & ev, const char *& Text) {
+
+  size_t Start, Len, Shift;
+  long long a = 0, b = 0, w = 0, h = 0;
+  MacroRegion Region;
+  char * End;
+  bool ok = true;
+  int Op;
+
+  memset ( &ev, 0, sizeof (ev) );
+  Text = 0;
+
+  // keep the text of this command in the buffer while we parse it
+  R.Mark = R.Pos;
+  if ( ! nextToken ( R, Start, Len ) ) return false;
+  R.Mark = Start;
+
+  if ( R.Buf[Start] == '#' ) {
+	// comments run to the end of the line
+	R.Pos = Start;
+	restOfLine ( R, Start, Len );
+	R.Text.assign ( R.Buf + Start, Len );
+	Text = R.Text.c_str ();
+	ev.Op = OpComment;
+	return true;
+  }
+
+  R.Text.assign ( R.Buf + Start, Len );
+  ev.Op = Op = lookupTag ( R.Buf + Start, Len );
+
+  switch ( Op ) {
+	case OpDelay:
+	case OpWaitForIdle:
+	  ok = nextName ( R ) && parseDuration ( R.Name, ev.A, ev.B );
+	  break;
+
+	case OpButtonPress:
+	case OpButtonRelease:
+	case OpKeyCodePress:
+	case OpKeyCodeRelease:
+	case OpKeySym:
+	case OpKeySymPress:
+	case OpKeySymRelease:
+	  ok = nextNumber ( R, a );
+	  ev.A = (int32_t) a;
+	  break;
+
+	case OpMotionNotify:
+	  ok = nextNumber ( R, a ) && nextNumber ( R, b );
+	  ev.A = (int32_t) a;
+	  ev.B = (int32_t) b;
+	  break;
+
+	case OpKeyStr:
+	case OpKeyStrPress:
+	case OpKeyStrRelease:
+	  // keysym names are resolved on the client, no display needed
+	  ok = nextName ( R );
+	  if ( ok ) ev.A = (int32_t) XStringToKeysym ( R.Name );
+	  Text = R.Name;
+	  break;
+
+	case OpString:
+	case OpPaste:
+	case OpWaitForWindow:
+	case OpWaitForMap:
+	case OpWaitForFocus:
+	  // the string is everything after the separating blank, any length
+	  if ( R.Pos == R.End ) refill ( R, Shift );
+	  if ( R.Pos < R.End && R.Buf[R.Pos] != '\n' ) R.Pos++;
+	  restOfLine ( R, Start, Len );
+	  ev.Len = Len;
+	  Text = R.Buf + Start;
+	  break;
+
+	case OpWaitForPixels:
+	case OpWaitForChange:
+	  ok = nextNumber ( R, a ) && nextNumber ( R, b ) && nextNumber ( R, w )
+		&& nextNumber ( R, h ) && w > 0 && h > 0;
+	  Region.Hash = 0;
+	  if ( ok && Op == OpWaitForPixels ) {
+		ok = nextName ( R );
+		if ( ok ) Region.Hash = strtoull ( R.Name, &End, 16 );
+		ok = ok && ! *End;
+	  }
+	  ev.A = (int32_t) a;
+	  ev.B = (int32_t) b;
+	  Region.W = (int32_t) w;
+	  Region.H = (int32_t) h;
+	  // the region goes out like a string, the name buffer holds it
+	  memcpy ( R.Name, &Region, sizeof (Region) );
+	  ev.Len = sizeof (Region);
+	  Text = R.Name;
+	  break;
+
+	case OpKeyMap:
+	  // the fingerprint is written in hex, like the hash of WaitForPixels
+	  ok = nextName ( R );
+	  if ( ok ) a = (long long) strtoull ( R.Name, &End, 16 );
+	  ok = ok && ! *End;
+	  ev.A = (int32_t)( a & 0xffffffff );
+	  ev.B = (int32_t)( (unsigned long long) a >> 32 );
+	  break;
+
+	default:
+	  Text = R.Text.c_str ();
+	  return true;
+  }
+
+  if ( ! ok ) {
+	// a missing or malformed operand, report the tag as unknown
+	restOfLine ( R, Start, Len );
+	memset ( &ev, 0, sizeof (ev) );
+	ev.Op = OpUnknown;
+	Text = R.Text.c_str ();
+  }
+
+  return true;
+}
+
+/****************************************************************************/
+/*! Starts a compiled macro in \a Out by appending a header. The event count
+    is filled in by finishMacro().
+*/
+/****************************************************************************/
+void beginMacro (string & Out) {
+
+  MacroHeader h;
+
+  memcpy ( h.Magic, MACRO_MAGIC, sizeof (h.Magic) );
+  h.Version = MacroVersion;
+  h.ByteOrder = MacroByteOrder;
+  h.Count = 0;
+  h.RecordSize = sizeof (MacroEvent);
+  Out.append ( (const char *) &h, sizeof (h) );
+}
+
+/****************************************************************************/
+/*! Appends the event \a ev to the compiled macro \a Out. If the event has a
+    payload it is stored right after the record and padded with zeroes.
+*/
+/****************************************************************************/
+void appendMacroEvent (string & Out, const MacroEvent & ev, const char * Text) {
+
+  Out.append ( (const char *) &ev, sizeof (ev) );
+  if ( ev.Len ) {
+	Out.append ( Text, ev.Len );
+	Out.append ( ( sizeof (MacroEvent) - ev.Len % sizeof (MacroEvent) )
+				 % sizeof (MacroEvent), '\0' );
+  }
+}
+
+/****************************************************************************/
+/*! Stores the final event count \a Count in the header of \a Out.
+*/
+/****************************************************************************/
+void finishMacro (string & Out, uint32_t Count) {
+
+  MacroHeader * h = (MacroHeader *) &Out[0];
+
+  h->Count = Count;
+}
+
+/****************************************************************************/
+/*! Appends the duration of \a Sec seconds and \a Usec microseconds to \a Out
+    in the largest unit that shows it exactly, as parseDuration() reads it.
+*/
+/****************************************************************************/
+static void formatDuration (string & Out, int32_t Sec, int32_t Usec) {
+
+  char Text[32];
+  long long Micro = Sec * 1000000LL + Usec;
+
+  if ( ! Usec ) snprintf ( Text, sizeof (Text), "%d", Sec );
+  else if ( Usec % 1000 == 0 ) snprintf ( Text, sizeof (Text), "%lldms", Micro / 1000 );
+  else snprintf ( Text, sizeof (Text), "%lldus", Micro );
+  Out += Text;
+}
+
+/****************************************************************************/
+/*! Appends the event \a ev as a line of the text language to \a Out, the
+    way readMacroEvent() reads it back. \a Text is the payload of the event,
+	or the comment. Keysyms are written by name. Nop and unknown events are
+	left out.
+
+	\arg string & Out - receives the line.
+	\arg const MacroEvent & ev - the event.
+	\arg const char * Text - the payload, if the event has one.
+*/
+/****************************************************************************/
+void formatMacroEvent (string & Out, const MacroEvent & ev, const char * Text) {
+
+  const char * Name;
+  MacroRegion Region;
+  char Line[128];
+
+  switch ( ev.Op ) {
+	case OpDelay:
+	case OpWaitForIdle:
+	  Out += macroOpName ( ev.Op );
+	  Out += ' ';
+	  formatDuration ( Out, ev.A, ev.B );
+	  Out += '\n';
+	  return;
+
+	case OpButtonPress:
+	case OpButtonRelease:
+	case OpKeyCodePress:
+	case OpKeyCodeRelease:
+	case OpKeySym:
+	case OpKeySymPress:
+	case OpKeySymRelease:
+	  snprintf ( Line, sizeof (Line), "%s %d\n", macroOpName ( ev.Op ), ev.A );
+	  break;
+
+	case OpMotionNotify:
+	  snprintf ( Line, sizeof (Line), "MotionNotify %d %d\n", ev.A, ev.B );
+	  break;
+
+	case OpKeyStr:
+	case OpKeyStrPress:
+	case OpKeyStrRelease:
+	  // a keysym without a name can only be given as a number
+	  if ( ! ( Name = XKeysymToString ( (KeySym)(uint32_t) ev.A ) ) )
+		snprintf ( Line, sizeof (Line), "%s %d\n",
+				   macroOpName ( ev.Op - OpKeyStr + OpKeySym ), ev.A );
+	  else
+		snprintf ( Line, sizeof (Line), "%s %s\n", macroOpName ( ev.Op ), Name );
+	  break;
+
+	case OpString:
+	case OpPaste:
+	case OpWaitForWindow:
+	case OpWaitForMap:
+	case OpWaitForFocus:
+	  Out += macroOpName ( ev.Op );
+	  Out += ' ';
+	  Out.append ( Text, ev.Len );
+	  Out += '\n';
+	  return;
+
+	case OpWaitForPixels:
+	case OpWaitForChange:
+	  memcpy ( &Region, Text, sizeof (Region) );
+	  snprintf ( Line, sizeof (Line), "%s %d %d %d %d", macroOpName ( ev.Op ),
+				 ev.A, ev.B, Region.W, Region.H );
+	  Out += Line;
+	  if ( ev.Op == OpWaitForPixels ) {
+		snprintf ( Line, sizeof (Line), " %016llx", (unsigned long long) Region.Hash );
+		Out += Line;
+	  }
+	  Out += '\n';
+	  return;
+
+	case OpKeyMap:
+	  snprintf ( Line, sizeof (Line), "KeyMap %016llx\n", (unsigned long long) macroKeyMap ( ev ) );
+	  break;
+
+	case OpComment:
+	  Out += Text;
+	  Out += '\n';
+	  return;
+
+	default:
+	  return;
+  }
+
+  Out += Line;
+}
+
+/****************************************************************************/
+/*! Compiles the text macro read by \a R into \a Out. Comments are dropped,
+    unknown tags and unknown keysym names are reported and skipped. Returns
+	the number of events compiled.
+
+	\arg MacroReader & R - the macro text.
+	\arg string & Out - receives the compiled macro.
+*/
+/****************************************************************************/
+uint32_t compileMacro (MacroReader & R, string & Out) {
+
+  MacroEvent ev;
+  const char * Text;
+  uint32_t Count = 0;
+
+  beginMacro ( Out );
+
+  while ( readMacroEvent ( R, ev, Text ) ) {
+	switch ( ev.Op ) {
+	  case OpComment:
+		continue;
+
+	  case OpUnknown:
+		cerr << "Unknown tag: " << Text << endl;
+		continue;
+
+	  case OpKeyStr:
+	  case OpKeyStrPress:
+	  case OpKeyStrRelease:
+		if ( ev.A == NoSymbol ) {
+		  cerr << "Unknown keysym name: " << Text << endl;
+		  continue;
+		}
+		break;
+	}
+
+	appendMacroEvent ( Out, ev, Text );
+	Count++;
+  }
+
+  finishMacro ( Out, Count );
+  return Count;
+}
+
+/****************************************************************************/
+/*! Checks that the \a Size bytes at \a Data are a compiled macro we can play
+    and fills in the event range of \a File. Returns 1 if so, 0 if it is not
+	a compiled macro at all and -1 if it is one we can not play.
+*/
+/****************************************************************************/
+static int checkMacro (const void * Data, size_t Size, MacroFile & File) {
+
+  const MacroHeader * h = (const MacroHeader *) Data;
+  const MacroEvent * ev;
+  MacroRegion Region;
+  uint32_t i;
+
+  if ( Size < sizeof (MacroHeader)
+	   || memcmp ( h->Magic, MACRO_MAGIC, sizeof (h->Magic) ) )
+	return 0;
+
+  if ( h->Version != MacroVersion || h->ByteOrder != MacroByteOrder
+	   || h->RecordSize != sizeof (MacroEvent) )
+	return -1;
+
+  File.Count = h->Count;
+  File.First = (const MacroEvent *)( h + 1 );
+  File.End   = (const MacroEvent *)( (const char *) Data + Size );
+
+  // make sure walking the stream never leaves the data, and that every
+  // record is a command that can be compiled
+  for ( ev = File.First, i = 0; i < File.Count; i++ ) {
+	if ( (const char *)( ev + 1 ) > (const char *) File.End
+		 || ev->Len > (size_t)( (const char *) File.End - macroPayload ( ev ) )
+		 || macroNext ( ev ) > File.End
+		 || ev->Op < OpNop || ev->Op > OpKeyMap )
+	  return -1;
+
+	// the WaitFor commands on pixels grab the region they carry
+	if ( ev->Op == OpWaitForPixels || ev->Op == OpWaitForChange ) {
+	  if ( ev->Len != sizeof (Region) ) return -1;
+	  memcpy ( &Region, macroPayload ( ev ), sizeof (Region) );
+	  if ( Region.W <= 0 || Region.H <= 0 ) return -1;
+	}
+	ev = macroNext ( ev );
+  }
+  File.End = ev;
+
+  return 1;
+}
+
+/****************************************************************************/
+/*! Maps the compiled macro open on \a Fd into memory. Returns 1 if \a File
+    now holds the macro, 0 if \a Fd is not a compiled macro (i.e. it should
+	be read as text) and -1 if it is a compiled macro we can not play. The
+	file offset of \a Fd is left untouched.
+
+	\arg int Fd - file descriptor of the macro.
+	\arg MacroFile & File - receives the mapping.
+*/
+/****************************************************************************/
+int mapMacro (int Fd, MacroFile & File) {
+
+  struct stat st;
+  int Result;
+
+  memset ( &File, 0, sizeof (File) );
+
+  // only regular files can be mapped, pipes are always text
+  if ( fstat ( Fd, &st ) || ! S_ISREG ( st.st_mode )
+	   || (size_t) st.st_size < sizeof (MacroHeader) )
+	return 0;
+
+  File.Size = st.st_size;
+  File.Base = mmap ( 0, File.Size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, Fd, 0 );
+  if ( File.Base == MAP_FAILED ) {
+	File.Base = 0;
+	return 0;
+  }
+
+  if ( ( Result = checkMacro ( File.Base, File.Size, File ) ) != 1 ) {
+	unmapMacro ( File );
+	return Result;
+  }
+
+  madvise ( File.Base, File.Size, MADV_SEQUENTIAL );
+  return 1;
+}
+
+/****************************************************************************/
+/*! Like mapMacro(), for a macro that is already in memory at \a Data. The
+    data must stay around while \a File is used.
+*/
+/****************************************************************************/
+int bufferMacro (const void * Data, size_t Size, MacroFile & File) {
+
+  int Result;
+
+  memset ( &File, 0, sizeof (File) );
+  if ( ( Result = checkMacro ( Data, Size, File ) ) != 1 )
+	memset ( &File, 0, sizeof (File) );
+  return Result;
+}
+
+/****************************************************************************/
+/*! Releases a macro mapped by mapMacro().
+*/
+/****************************************************************************/
+void unmapMacro (MacroFile & File) {
+
+  if ( File.Base ) munmap ( File.Base, File.Size );
+  memset ( &File, 0, sizeof (File) );
+}
@@ -0,0 +1,163 @@
+/*****************************************************************************
+ *
+ * macro.h is the macro language front end shared by the xmacro utilities
+ *
+ * Contains the layout of the compiled (binary) macro format written by
+ * xmacroc and played by xmacroplay, and the text parser that turns the
+ * macro language into compiled events.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_MACRO_H
+#define XMACRO_MACRO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/*****************************************************************************
+ * The compiled format is a MacroHeader followed by Count MacroEvent records.
+ * String payloads are stored inline right after their record, padded to a
+ * whole number of records, so the stream can be walked without parsing.
+ * Everything is in host byte order; ByteOrder catches foreign files.
+ ****************************************************************************/
+#define MACRO_MAGIC "XMAC"
+
+const uint16_t MacroVersion   = 1;
+const uint16_t MacroByteOrder = 0x0102;
+
+enum MacroOp {
+  OpNop = 0,
+  OpDelay,				// A: seconds, B: microseconds
+  OpButtonPress,		// A: button
+  OpButtonRelease,		// A: button
+  OpMotionNotify,		// A: x, B: y
+  OpKeyCodePress,		// A: keycode
+  OpKeyCodeRelease,		// A: keycode
+  OpKeySym,				// A: keysym
+  OpKeySymPress,		// A: keysym
+  OpKeySymRelease,		// A: keysym
+  OpKeyStr,				// A: keysym, resolved from its name when compiled
+  OpKeyStrPress,		// A: keysym
+  OpKeyStrRelease,		// A: keysym
+  OpString,				// Len bytes of text follow the record
+  OpPaste,				// Len bytes of text follow the record
+  OpWaitForWindow,		// Len bytes of window pattern follow the record
+  OpWaitForMap,			// Len bytes of window pattern follow the record
+  OpWaitForFocus,		// Len bytes of window pattern follow the record
+  OpWaitForIdle,		// A: seconds, B: microseconds
+  OpWaitForPixels,		// A: x, B: y, a MacroRegion follows the record
+  OpWaitForChange,		// A: x, B: y, a MacroRegion follows, its Hash is 0
+  OpKeyMap,				// A, B: low and high half of a keymap fingerprint
+  OpComment,			// text front end only, never compiled
+  OpUnknown				// text front end only, never compiled
+};
+
+struct MacroHeader {
+  char     Magic[4];
+  uint16_t Version;
+  uint16_t ByteOrder;
+  uint32_t Count;
+  uint32_t RecordSize;
+};
+
+struct MacroEvent {
+  uint8_t  Op;
+  uint8_t  Flags;
+  uint16_t Reserved;
+  uint32_t Len;
+  int32_t  A;
+  int32_t  B;
+};
+
+/*****************************************************************************
+ * The payload of WaitForPixels and WaitForChange: the size of the region
+ * and the hash (see hashRegion()) it must have.
+ ****************************************************************************/
+struct MacroRegion {
+  int32_t  W;
+  int32_t  H;
+  uint64_t Hash;
+};
+
+/*****************************************************************************
+ * A compiled macro mapped into memory.
+ ****************************************************************************/
+struct MacroFile {
+  void *             Base;
+  size_t             Size;
+  const MacroEvent * First;
+  const MacroEvent * End;
+  uint32_t           Count;
+};
+
+/*****************************************************************************
+ * Reads the text language straight from a file descriptor. Regular files
+ * are mapped, other input is read in blocks of MacroReadBlock bytes; the
+ * commands are tokenized where they are in the buffer.
+ ****************************************************************************/
+const size_t MacroReadBlock = 1 << 16;
+
+struct MacroReader {
+  int          Fd;
+  char *       Buf;
+  size_t       Pos, End, Cap;
+  size_t       Mark;			// start of the command being parsed
+  bool         Mapped, Borrowed, Eof;
+  char         Name[256];		// keysym names and other short operands
+  std::string  Text;			// tags and comments
+};
+
+/****************************************************************************/
+/*! Returns the payload of the event \a ev, i.e. the text of a String.
+*/
+/****************************************************************************/
+inline const char * macroPayload (const MacroEvent * ev) {
+  return (const char *)( ev + 1 );
+}
+
+/****************************************************************************/
+/*! Returns the keymap fingerprint of the KeyMap command \a ev.
+*/
+/****************************************************************************/
+inline uint64_t macroKeyMap (const MacroEvent & ev) {
+  return (uint32_t) ev.A | (uint64_t)(uint32_t) ev.B << 32;
+}
+
+/****************************************************************************/
+/*! Returns the event following \a ev in a compiled stream.
+*/
+/****************************************************************************/
+inline const MacroEvent * macroNext (const MacroEvent * ev) {
+  return ev + 1 + ( ev->Len + sizeof (MacroEvent) - 1 ) / sizeof (MacroEvent);
+}
+
+const char * macroOpName (int Op);
+bool parseDuration (const char * Text, int32_t & Sec, int32_t & Usec);
+void openMacroReader (MacroReader & R, int Fd);
+void openMacroBuffer (MacroReader & R, const char * Data, size_t Size);
+void closeMacroReader (MacroReader & R);
+bool readMacroEvent (MacroReader & R, MacroEvent & ev, const char *& Text);
+void appendMacroEvent (std::string & Out, const MacroEvent & ev, const char * Text);
+void formatMacroEvent (std::string & Out, const MacroEvent & ev, const char * Text);
+void beginMacro (std::string & Out);
+void finishMacro (std::string & Out, uint32_t Count);
+uint32_t compileMacro (MacroReader & R, std::string & Out);
+int  mapMacro (int Fd, MacroFile & File);
+int  bufferMacro (const void * Data, size_t Size, MacroFile & File);
+void unmapMacro (MacroFile & File);
+
+#endif
@@ -0,0 +1,305 @@
+/*****************************************************************************
+ *
+ * optimize.cpp - the peephole optimizer of macros of the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <string.h>
+
+#include "optimize.h"
+
+using namespace std;
+
+/****************************************************************************/
+/*! Returns how many XTest requests xmacroplay sends for the command \a ev
+    with the payload \a Text. A String types each character with a press
+	and a release; the modifiers it may need are not counted.
+*/
+/****************************************************************************/
+unsigned long macroRequests (const MacroEvent & ev, const char * Text) {
+
+  unsigned long Count = 0;
+  uint32_t i;
+
+  switch ( ev.Op ) {
+	case OpMotionNotify:
+	case OpButtonPress:
+	case OpButtonRelease:
+	case OpKeyCodePress:
+	case OpKeyCodeRelease:
+	case OpKeySymPress:
+	case OpKeySymRelease:
+	case OpKeyStrPress:
+	case OpKeyStrRelease:
+	  return 1;
+
+	case OpKeySym:
+	case OpKeyStr:
+	  return 2;
+
+	case OpString:
+	  // UTF-8 continuation bytes are part of the character before
+	  for ( i = 0; i < ev.Len; i++ )
+		if ( ( Text[i] & 0xc0 ) != 0x80 ) Count++;
+	  return Count * 2;
+
+	default:
+	  return 0;
+  }
+}
+
+/****************************************************************************/
+/*! Sets up \a O to optimize a macro from its start. Emit and Arg are left
+    to the caller.
+*/
+/****************************************************************************/
+void startOptimizer (MacroOptimizer & O) {
+
+  O.Moved = O.Waiting = O.Pressed = false;
+  O.x = O.y = 0;
+  O.Delay = 0;
+  O.Run.clear ();
+  O.Held = 0;
+  memset ( &O.Stats, 0, sizeof (O.Stats) );
+}
+
+/****************************************************************************/
+/*! Hands the optimized command \a ev to the emitter of \a O and counts it.
+*/
+/****************************************************************************/
+static void emit (MacroOptimizer & O, const MacroEvent & ev, const char * Text) {
+
+  if ( ev.Op != OpComment && ev.Op != OpUnknown ) {
+	O.Stats.After++;
+	O.Stats.RequestsAfter += macroRequests ( ev, Text );
+  }
+  O.Emit ( O.Arg, ev, Text );
+}
+
+/****************************************************************************/
+/*! Emits the characters typed in a row, as a String if there are several.
+*/
+/****************************************************************************/
+static void flushRun (MacroOptimizer & O) {
+
+  MacroEvent ev;
+
+  if ( O.Run.empty () ) return;
+
+  memset ( &ev, 0, sizeof (ev) );
+  if ( O.Run.size () == 1 ) {
+	// the Latin-1 keysyms are the characters
+	ev.Op = OpKeyStr;
+	ev.A = (unsigned char) O.Run[0];
+  }
+  else {
+	ev.Op = OpString;
+	ev.Len = O.Run.size ();
+	O.Stats.Strings++;
+	O.Stats.Typed += O.Run.size ();
+  }
+  emit ( O, ev, O.Run.data () );
+  O.Run.clear ();
+}
+
+/****************************************************************************/
+/*! The last stage: collects typed characters into a String. Only lower
+    case letters and spaces are taken, they are on the first level of any
+	Latin keyboard, so typing them as a String holds no other modifiers
+	than pressing their keys did. Nothing is taken while another key is
+	held, as it may be a modifier.
+*/
+/****************************************************************************/
+static void passRun (MacroOptimizer & O, const MacroEvent & ev, const char * Text) {
+
+  if ( ( ev.Op == OpKeyStr || ev.Op == OpKeySym ) && ! O.Held
+	   && ( ( ev.A >= 'a' && ev.A <= 'z' ) || ev.A == ' ' ) ) {
+	O.Run += (char) ev.A;
+	return;
+  }
+
+  flushRun ( O );
+
+  switch ( ev.Op ) {
+	case OpKeyCodePress:
+	case OpKeySymPress:
+	case OpKeyStrPress:
+	  O.Held++;
+	  break;
+
+	case OpKeyCodeRelease:
+	case OpKeySymRelease:
+	case OpKeyStrRelease:
+	  if ( O.Held ) O.Held--;
+	  break;
+  }
+
+  emit ( O, ev, Text );
+}
+
+/****************************************************************************/
+/*! Joins a press with the release of the same key right after it into one
+    command.
+*/
+/****************************************************************************/
+static void passPair (MacroOptimizer & O, const MacroEvent & ev, const char * Text) {
+
+  MacroEvent Both;
+
+  if ( O.Pressed ) {
+	O.Pressed = false;
+	if ( ev.Op == O.Press.Op + 1 && ev.A == O.Press.A ) {
+	  // OpKeySym before OpKeySymPress, OpKeyStr before OpKeyStrPress
+	  Both = O.Press;
+	  Both.Op = O.Press.Op - 1;
+	  O.Stats.Pairs++;
+	  passRun ( O, Both, 0 );
+	  return;
+	}
+	passRun ( O, O.Press, 0 );
+  }
+
+  if ( ev.Op == OpKeySymPress || ev.Op == OpKeyStrPress ) {
+	O.Press = ev;
+	O.Pressed = true;
+	return;
+  }
+
+  passRun ( O, ev, Text );
+}
+
+/****************************************************************************/
+/*! Passes on the Delays added up so far as one, if they wait at all.
+*/
+/****************************************************************************/
+static void flushDelay (MacroOptimizer & O) {
+
+  MacroEvent ev;
+
+  if ( ! O.Waiting ) return;
+  O.Waiting = false;
+
+  if ( ! O.Delay ) {
+	O.Stats.Delays++;
+	return;
+  }
+
+  memset ( &ev, 0, sizeof (ev) );
+  ev.Op = OpDelay;
+  ev.A = O.Delay / 1000000;
+  ev.B = O.Delay % 1000000;
+  O.Delay = 0;
+  passPair ( O, ev, 0 );
+}
+
+/****************************************************************************/
+/*! Takes the command \a ev with the payload \a Text into the optimizer \a O.
+    Optimized commands are emitted as soon as nothing that follows can
+	change them any more. Comments (and unknown tags) are kept where they
+	are, nothing is combined across them.
+
+	\arg MacroOptimizer & O - the optimizer.
+	\arg const MacroEvent & ev - the command.
+	\arg const char * Text - its payload, the comment or the keysym name.
+*/
+/****************************************************************************/
+void optimizeEvent (MacroOptimizer & O, const MacroEvent & ev, const char * Text) {
+
+  if ( ev.Op == OpComment || ev.Op == OpUnknown ) {
+	finishOptimizer ( O );
+	emit ( O, ev, Text );
+	return;
+  }
+
+  O.Stats.Before++;
+  O.Stats.RequestsBefore += macroRequests ( ev, Text );
+
+  switch ( ev.Op ) {
+	case OpMotionNotify:
+	  // no other command moves the pointer
+	  if ( O.Moved && ev.A == O.x && ev.B == O.y ) {
+		O.Stats.Motions++;
+		return;
+	  }
+	  O.Moved = true;
+	  O.x = ev.A;
+	  O.y = ev.B;
+	  break;
+
+	case OpDelay:
+	  if ( O.Waiting ) O.Stats.Delays++;
+	  O.Waiting = true;
+	  O.Delay += ev.A * 1000000LL + ev.B;
+	  O.Stats.DelayUsec += ev.A * 1000000LL + ev.B;
+	  return;
+  }
+
+  flushDelay ( O );
+  passPair ( O, ev, Text );
+}
+
+/****************************************************************************/
+/*! Emits what \a O still holds back, at the end of the macro.
+*/
+/****************************************************************************/
+void finishOptimizer (MacroOptimizer & O) {
+
+  flushDelay ( O );
+  if ( O.Pressed ) {
+	O.Pressed = false;
+	passRun ( O, O.Press, 0 );
+  }
+  flushRun ( O );
+}
+
+/****************************************************************************/
+/*! Appends an optimized command to the compiled macro at \a Arg.
+*/
+/****************************************************************************/
+static void appendOptimized (void * Arg, const MacroEvent & ev, const char * Text) {
+
+  appendMacroEvent ( *(string *) Arg, ev, Text );
+}
+
+/****************************************************************************/
+/*! Optimizes the compiled macro \a File into the compiled macro \a Out and
+    tells in \a Stats what was done.
+
+	\arg const MacroFile & File - the macro.
+	\arg string & Out - receives the optimized macro.
+	\arg OptimizeStats & Stats - receives what was optimized.
+*/
+/****************************************************************************/
+void optimizeMacro (const MacroFile & File, string & Out, OptimizeStats & Stats) {
+
+  MacroOptimizer O;
+  const MacroEvent * ev;
+
+  startOptimizer ( O );
+  O.Emit = appendOptimized;
+  O.Arg = &Out;
+
+  beginMacro ( Out );
+  for ( ev = File.First; ev < File.End; ev = macroNext ( ev ) )
+	optimizeEvent ( O, *ev, ev->Len ? macroPayload ( ev ) : 0 );
+  finishOptimizer ( O );
+  finishMacro ( Out, O.Stats.After );
+
+  Stats = O.Stats;
+}
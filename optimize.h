@@ -0,0 +1,78 @@
+/*****************************************************************************
+ *
+ * optimize.h is the peephole optimizer of macros shared by xmacroopt and
+ * xmacroplay
+ *
+ * Recorded macros say many things the long way. The optimizer looks at
+ * each command once, keeping back only the few it may still combine with
+ * what follows, and rewrites:
+ *
+ *  - a MotionNotify to where the pointer already is: dropped,
+ *  - consecutive Delays: one Delay of their sum,
+ *  - a KeyStrPress (KeySymPress) right before its KeyStrRelease
+ *    (KeySymRelease): one KeyStr (KeySym),
+ *  - runs of typed characters, while no other key is held: one String.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_OPTIMIZE_H
+#define XMACRO_OPTIMIZE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "macro.h"
+
+/*****************************************************************************
+ * What the optimizer did. The XTest requests are what xmacroplay sends to
+ * play the commands, each of them waits the delay between events ('-d');
+ * with the time the Delays wait this estimates how long a macro plays.
+ ****************************************************************************/
+struct OptimizeStats {
+  unsigned long Before, After;		// commands, without comments
+  unsigned long Motions;			// motions dropped
+  unsigned long Delays;				// Delays merged into another or dropped
+  unsigned long Pairs;				// presses joined with their release
+  unsigned long Strings, Typed;		// Strings made of Typed key commands
+  unsigned long RequestsBefore, RequestsAfter;
+  long long     DelayUsec;			// what the Delays wait, before and after
+};
+
+/*****************************************************************************
+ * The state of optimizing a stream of commands. The optimized commands are
+ * handed to Emit with their payload.
+ ****************************************************************************/
+struct MacroOptimizer {
+  void       (* Emit) (void * Arg, const MacroEvent & ev, const char * Payload);
+  void *        Arg;
+  bool          Moved;			// x, y is where the last motion went
+  int32_t       x, y;
+  bool          Waiting;		// Delay microseconds are still to be waited
+  long long     Delay;
+  bool          Pressed;		// Press waits for its release
+  MacroEvent    Press;
+  std::string   Run;			// characters typed in a row
+  int           Held;			// keys pressed and not released
+  OptimizeStats Stats;
+};
+
+void startOptimizer (MacroOptimizer & O);
+void optimizeEvent (MacroOptimizer & O, const MacroEvent & ev, const char * Text);
+void finishOptimizer (MacroOptimizer & O);
+void optimizeMacro (const MacroFile & File, std::string & Out, OptimizeStats & Stats);
+unsigned long macroRequests (const MacroEvent & ev, const char * Text);
+
+#endif
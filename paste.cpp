@@ -0,0 +1,238 @@
+/*****************************************************************************
+ *
+ * paste.cpp - the selection owner of the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include "paste.h"
+
+/****************************************************************************/
+/*! Creates the window owning the selections of \a Dpy and looks up the
+    atoms, all in one round trip.
+*/
+/****************************************************************************/
+static void createOwner (Display * Dpy, Selection & Sel) {
+
+  char * Names[] = { (char *) "CLIPBOARD", (char *) "TARGETS", (char *) "UTF8_STRING",
+					 (char *) "TEXT", (char *) "text/plain;charset=utf-8",
+					 (char *) "INCR" };
+  Atom Atoms[6];
+
+  Sel.Win = XCreateSimpleWindow ( Dpy, DefaultRootWindow ( Dpy ), -10, -10, 1, 1, 0, 0, 0 );
+  XSelectInput ( Dpy, Sel.Win, PropertyChangeMask );
+
+  XInternAtoms ( Dpy, Names, 6, False, Atoms );
+  Sel.Clipboard = Atoms[0];
+  Sel.Targets   = Atoms[1];
+  Sel.Utf8      = Atoms[2];
+  Sel.Text      = Atoms[3];
+  Sel.Plain     = Atoms[4];
+  Sel.Incr      = Atoms[5];
+
+  // leave room for the rest of the ChangeProperty request
+  Sel.Chunk = std::min ( XMaxRequestSize ( Dpy ) * 4 - 1024, 1L << 18 );
+}
+
+/****************************************************************************/
+/*! Makes us the owner of the CLIPBOARD and PRIMARY selections of \a Dpy,
+    offering the \a Len bytes of UTF-8 text at \a Text. The selections are
+	taken with a real timestamp, obtained from a PropertyNotify, as ICCCM
+	asks. Returns false if another client kept them.
+
+    \arg Display * Dpy - used display.
+	\arg Selection & Sel - the selection state.
+	\arg const char * Text - the text to offer.
+	\arg size_t Len - length of the text.
+*/
+/****************************************************************************/
+bool ownSelection (Display * Dpy, Selection & Sel, const char * Text, size_t Len) {
+
+  XEvent Event;
+  size_t i;
+
+  if ( Sel.Win == None ) createOwner ( Dpy, Sel );
+
+  Sel.Data.assign ( Text, Len );
+  Sel.Transfers.clear ();
+
+  // STRING is Latin-1, only the 7 bit text reads the same in it
+  Sel.Ascii = true;
+  for ( i = 0; i < Len; i++ )
+	if ( Text[i] & 0x80 ) Sel.Ascii = false;
+
+  // an empty append just to get the server time
+  XChangeProperty ( Dpy, Sel.Win, XA_WM_NAME, XA_STRING, 8, PropModeAppend, 0, 0 );
+  XWindowEvent ( Dpy, Sel.Win, PropertyChangeMask, &Event );
+  Sel.Stamp = Event.xproperty.time;
+
+  XSetSelectionOwner ( Dpy, Sel.Clipboard, Sel.Win, Sel.Stamp );
+  XSetSelectionOwner ( Dpy, XA_PRIMARY, Sel.Win, Sel.Stamp );
+  Sel.Owned = XGetSelectionOwner ( Dpy, Sel.Clipboard ) == Sel.Win
+	&& XGetSelectionOwner ( Dpy, XA_PRIMARY ) == Sel.Win;
+
+  return Sel.Owned;
+}
+
+/****************************************************************************/
+/*! Gives up the selections if we still own them and drops the text.
+*/
+/****************************************************************************/
+void disownSelection (Display * Dpy, Selection & Sel) {
+
+  size_t i;
+
+  if ( Sel.Owned ) {
+	XSetSelectionOwner ( Dpy, Sel.Clipboard, None, Sel.Stamp );
+	XSetSelectionOwner ( Dpy, XA_PRIMARY, None, Sel.Stamp );
+	Sel.Owned = false;
+  }
+
+  for ( i = 0; i < Sel.Transfers.size (); i++ )
+	XSelectInput ( Dpy, Sel.Transfers[i].Requestor, NoEventMask );
+  Sel.Transfers.clear ();
+  Sel.Data.clear ();
+}
+
+/****************************************************************************/
+/*! Answers the SelectionRequest \a Req: the list of targets, or the text
+    itself, directly or starting an INCR transfer if it does not fit in one
+	request. The text is UTF-8, so it is offered as STRING only when it is
+	7 bit. Returns true if the text was handed over completely.
+*/
+/****************************************************************************/
+static bool answerRequest (Display * Dpy, Selection & Sel, XSelectionRequestEvent & Req) {
+
+  XEvent Reply;
+  SelectionTransfer Transfer;
+  Atom Offer[] = { Sel.Targets, Sel.Utf8, Sel.Plain, Sel.Text, XA_STRING };
+  Atom Type;
+  long Size;
+  bool Done = false;
+
+  Reply.xselection.type      = SelectionNotify;
+  Reply.xselection.display   = Dpy;
+  Reply.xselection.requestor = Req.requestor;
+  Reply.xselection.selection = Req.selection;
+  Reply.xselection.target    = Req.target;
+  Reply.xselection.time      = Req.time;
+  // obsolete clients don't name a property, use the target then
+  Reply.xselection.property  = Req.property == None ? Req.target : Req.property;
+
+  if ( ! Sel.Owned || Req.owner != Sel.Win
+	   || ( Req.time != CurrentTime && Req.time < Sel.Stamp ) )
+	Reply.xselection.property = None;
+
+  else if ( Req.target == Sel.Targets )
+	XChangeProperty ( Dpy, Req.requestor, Reply.xselection.property, XA_ATOM, 32,
+					  PropModeReplace, (unsigned char *) Offer, Sel.Ascii ? 5 : 4 );
+
+  else if ( Req.target == Sel.Utf8 || Req.target == Sel.Plain
+			|| Req.target == Sel.Text || ( Req.target == XA_STRING && Sel.Ascii ) ) {
+	Type = Req.target == Sel.Text ? Sel.Utf8 : Req.target;
+
+	if ( Sel.Data.size () <= Sel.Chunk ) {
+	  XChangeProperty ( Dpy, Req.requestor, Reply.xselection.property, Type, 8,
+						PropModeReplace, (const unsigned char *) Sel.Data.data (),
+						Sel.Data.size () );
+	  Done = true;
+	}
+	else {
+	  // too large, the chunks follow when the requestor deletes the property
+	  Transfer.Requestor = Req.requestor;
+	  Transfer.Property  = Reply.xselection.property;
+	  Transfer.Type      = Type;
+	  Transfer.Sent      = 0;
+	  Sel.Transfers.push_back ( Transfer );
+
+	  Size = Sel.Data.size ();
+	  XSelectInput ( Dpy, Req.requestor, PropertyChangeMask );
+	  XChangeProperty ( Dpy, Req.requestor, Transfer.Property, Sel.Incr, 32,
+						PropModeReplace, (unsigned char *) &Size, 1 );
+	}
+  }
+
+  else Reply.xselection.property = None;
+
+  XSendEvent ( Dpy, Req.requestor, False, NoEventMask, &Reply );
+  return Done;
+}
+
+/****************************************************************************/
+/*! Writes the next chunk of the INCR transfer \a t. The last chunk is empty.
+    Returns true when the transfer is over.
+*/
+/****************************************************************************/
+static bool sendChunk (Display * Dpy, Selection & Sel, SelectionTransfer & t) {
+
+  size_t Len = std::min ( Sel.Chunk, Sel.Data.size () - t.Sent );
+
+  XChangeProperty ( Dpy, t.Requestor, t.Property, t.Type, 8, PropModeReplace,
+					(const unsigned char *) Sel.Data.data () + t.Sent, Len );
+  t.Sent += Len;
+
+  if ( Len ) return false;
+
+  XSelectInput ( Dpy, t.Requestor, NoEventMask );
+  return true;
+}
+
+/****************************************************************************/
+/*! Handles \a Event if it concerns the selection \a Sel. Returns true when
+    a client has received the whole text.
+
+    \arg Display * Dpy - used display.
+	\arg Selection & Sel - the selection state.
+	\arg XEvent & Event - the event.
+*/
+/****************************************************************************/
+bool handleSelectionEvent (Display * Dpy, Selection & Sel, XEvent & Event) {
+
+  size_t i;
+
+  switch ( Event.type ) {
+	case SelectionRequest:
+	  return answerRequest ( Dpy, Sel, Event.xselectionrequest );
+
+	case SelectionClear:
+	  // someone else took one of them, don't answer for the other either
+	  if ( Event.xselectionclear.window == Sel.Win ) Sel.Owned = false;
+	  return false;
+
+	case PropertyNotify:
+	  if ( Event.xproperty.state != PropertyDelete ) return false;
+
+	  for ( i = 0; i < Sel.Transfers.size (); i++ ) {
+		SelectionTransfer & t = Sel.Transfers[i];
+
+		if ( t.Requestor != Event.xproperty.window
+			 || t.Property != Event.xproperty.atom ) continue;
+
+		if ( ! sendChunk ( Dpy, Sel, t ) ) return false;
+		Sel.Transfers.erase ( Sel.Transfers.begin () + i );
+		return true;
+	  }
+	  return false;
+  }
+
+  return false;
+}
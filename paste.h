@@ -0,0 +1,57 @@
+/*****************************************************************************
+ *
+ * paste.h is the selection owner of the xmacro utilities
+ *
+ * Lets xmacroplay offer a text as the CLIPBOARD and PRIMARY selection, so a
+ * long text can be pasted with one key chord instead of being typed. Texts
+ * larger than a request are handed over with the INCR protocol.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_PASTE_H
+#define XMACRO_PASTE_H
+
+#include <string>
+#include <vector>
+#include <X11/Xlib.h>
+
+/*****************************************************************************
+ * An INCR transfer in progress: the next chunk is written to Property of
+ * Requestor when the previous one has been deleted.
+ ****************************************************************************/
+struct SelectionTransfer {
+  Window Requestor;
+  Atom   Property;
+  Atom   Type;
+  size_t Sent;
+};
+
+struct Selection {
+  Window                         Win = None;	// the owner, never mapped
+  Time                           Stamp;		// when we became the owner
+  bool                           Owned = false;
+  std::string                    Data;
+  bool                           Ascii;		// Data is also a valid STRING
+  size_t                         Chunk;		// largest property written at once
+  std::vector<SelectionTransfer> Transfers;
+  Atom                           Clipboard, Targets, Utf8, Text, Plain, Incr;
+};
+
+bool ownSelection (Display * Dpy, Selection & Sel, const char * Text, size_t Len);
+void disownSelection (Display * Dpy, Selection & Sel);
+bool handleSelectionEvent (Display * Dpy, Selection & Sel, XEvent & Event);
+
+#endif
@@ -0,0 +1,191 @@
+/*****************************************************************************
+ *
+ * region.cpp - grabs and hashes screen regions for the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+#include "region.h"
+
+/*****************************************************************************
+ * The hash runs over 8 lanes of 32 bits at once, i.e. one AVX2 register or
+ * two SSE2 registers; g++ lowers the vector type to whatever the target
+ * has. Each lane is a multiply-rotate hash of every 8th word of the region.
+ ****************************************************************************/
+typedef uint32_t Lanes __attribute__ (( vector_size (32) ));
+
+const uint32_t HashPrime1 = 0x9E3779B1u;
+const uint32_t HashPrime2 = 0x85EBCA77u;
+
+/****************************************************************************/
+/*! Set by trapError when MIT-SHM could not be attached.
+*/
+/****************************************************************************/
+static bool ShmFailed;
+
+static int trapError (Display *, XErrorEvent *) {
+
+  ShmFailed = true;
+  return 0;
+}
+
+/****************************************************************************/
+/*! Prepares \a G for grabbing regions of \a W x \a H pixels from \a Screen.
+    MIT-SHM is used if the server has it and can attach our segment (it
+	can't over the network), else the regions are fetched with XGetImage.
+	Returns false if the size is not valid.
+
+    \arg Display * Dpy - used display.
+	\arg int Screen - the screen.
+	\arg int W, H - size of the region.
+	\arg RegionGrab & G - receives the grab.
+*/
+/****************************************************************************/
+bool openGrab (Display * Dpy, int Screen, int W, int H, RegionGrab & G) {
+
+  XErrorHandler Old;
+
+  closeGrab ( Dpy, G );
+  if ( W <= 0 || H <= 0 ) return false;
+  G.W = W;
+  G.H = H;
+
+  if ( ! XShmQueryExtension ( Dpy ) ) return true;
+
+  G.Img = XShmCreateImage ( Dpy, DefaultVisual ( Dpy, Screen ), DefaultDepth ( Dpy, Screen ),
+							ZPixmap, 0, &G.Shm, W, H );
+  if ( ! G.Img ) return true;
+
+  G.Shm.shmid = shmget ( IPC_PRIVATE, G.Img->bytes_per_line * H, IPC_CREAT | 0600 );
+  G.Shm.shmaddr = G.Img->data = G.Shm.shmid < 0 ? (char *) -1
+	: (char *) shmat ( G.Shm.shmid, 0, 0 );
+  G.Shm.readOnly = False;
+
+  if ( G.Shm.shmaddr != (char *) -1 ) {
+	// the attach fails with an error, not a status
+	XSync ( Dpy, False );
+	ShmFailed = false;
+	Old = XSetErrorHandler ( trapError );
+	XShmAttach ( Dpy, &G.Shm );
+	XSync ( Dpy, False );
+	XSetErrorHandler ( Old );
+	G.UseShm = ! ShmFailed;
+	if ( ! G.UseShm ) shmdt ( G.Shm.shmaddr );
+  }
+
+  // the segment goes away with the last user
+  if ( G.Shm.shmid >= 0 ) shmctl ( G.Shm.shmid, IPC_RMID, 0 );
+
+  if ( ! G.UseShm ) {
+	G.Img->data = 0;
+	XDestroyImage ( G.Img );
+	G.Img = 0;
+  }
+  return true;
+}
+
+/****************************************************************************/
+/*! Grabs the region at \a x, \a y of the size \a G was opened for. Returns
+    false if it is not on the screen.
+*/
+/****************************************************************************/
+bool grabRegion (Display * Dpy, int Screen, int x, int y, RegionGrab & G) {
+
+  Window Root = RootWindow ( Dpy, Screen );
+
+  if ( x < 0 || y < 0 || x + G.W > DisplayWidth ( Dpy, Screen )
+	   || y + G.H > DisplayHeight ( Dpy, Screen ) )
+	return false;
+
+  if ( G.UseShm ) return XShmGetImage ( Dpy, Root, G.Img, x, y, AllPlanes );
+
+  if ( G.Img ) XDestroyImage ( G.Img );
+  G.Img = XGetImage ( Dpy, Root, x, y, G.W, G.H, AllPlanes, ZPixmap );
+  return G.Img != 0;
+}
+
+/****************************************************************************/
+/*! Releases the image and the shared memory of \a G.
+*/
+/****************************************************************************/
+void closeGrab (Display * Dpy, RegionGrab & G) {
+
+  if ( G.UseShm ) {
+	XShmDetach ( Dpy, &G.Shm );
+	G.Img->data = 0;
+	shmdt ( G.Shm.shmaddr );
+  }
+  if ( G.Img ) XDestroyImage ( G.Img );
+
+  G.Img = 0;
+  G.UseShm = false;
+  G.W = G.H = 0;
+}
+
+/****************************************************************************/
+/*! Hashes the pixels of \a Img. Only the bytes of the pixels count, not the
+    padding at the end of the lines, and for 32 bit pixels only the colour
+	bits, as the unused byte is not always zero.
+*/
+/****************************************************************************/
+uint64_t hashRegion (const XImage * Img) {
+
+  const size_t Width = (size_t) Img->width * Img->bits_per_pixel / 8;
+  uint32_t Mask = 0xFFFFFFFFu;
+  Lanes h, m, v;
+  size_t Col;
+  uint64_t Sum;
+  int Row, i;
+
+  if ( Img->bits_per_pixel == 32 )
+	Mask = Img->red_mask | Img->green_mask | Img->blue_mask;
+  for ( i = 0; i < 8; i++ ) {
+	h[i] = HashPrime1 * ( i + 1 );
+	m[i] = Mask;
+  }
+
+  for ( Row = 0; Row < Img->height; Row++ ) {
+	const char * Line = Img->data + (size_t) Row * Img->bytes_per_line;
+
+	for ( Col = 0; Col + sizeof (Lanes) <= Width; Col += sizeof (Lanes) ) {
+	  memcpy ( &v, Line + Col, sizeof (Lanes) );
+	  h = ( h ^ ( v & m ) ) * HashPrime2;
+	  h = ( h << 13 ) | ( h >> 19 );
+	}
+
+	if ( Col < Width ) {
+	  // the rest of the line, padded with zeroes
+	  v = Lanes {};
+	  memcpy ( &v, Line + Col, Width - Col );
+	  h = ( h ^ ( v & m ) ) * HashPrime2;
+	  h = ( h << 13 ) | ( h >> 19 );
+	}
+  }
+
+  // fold the lanes
+  for ( Sum = Width * Img->height, i = 0; i < 8; i++ )
+	Sum = ( Sum ^ h[i] ) * 0x100000001B3ULL;
+  return Sum;
+}
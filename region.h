@@ -0,0 +1,49 @@
+/*****************************************************************************
+ *
+ * region.h grabs and hashes screen regions for the xmacro utilities
+ *
+ * The recorder hashes a region of the screen at a checkpoint, xmacroplay
+ * grabs the same region over and over until it has that hash again. The
+ * region is grabbed through MIT-SHM if the server offers it, so the pixels
+ * don't travel through the socket, and hashed with a vector kernel.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_REGION_H
+#define XMACRO_REGION_H
+
+#include <stdint.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+/*****************************************************************************
+ * An image of W x H pixels the region is grabbed into. With MIT-SHM it is
+ * attached to the server once and reused for every grab.
+ ****************************************************************************/
+struct RegionGrab {
+  XImage *        Img = 0;
+  XShmSegmentInfo Shm;
+  bool            UseShm = false;
+  int             W = 0, H = 0;
+};
+
+bool     openGrab (Display * Dpy, int Screen, int W, int H, RegionGrab & G);
+bool     grabRegion (Display * Dpy, int Screen, int x, int y, RegionGrab & G);
+void     closeGrab (Display * Dpy, RegionGrab & G);
+uint64_t hashRegion (const XImage * Img);
+
+#endif
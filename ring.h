@@ -0,0 +1,220 @@
+/*****************************************************************************
+ *
+ * ring.h is the single producer, single consumer queue of the xmacro
+ * utilities
+ *
+ * A fixed ring of Size slots (a power of two) handed from one thread to
+ * another without locks: the producer fills the slot at Head and publishes
+ * it by moving Head, the consumer uses the slot at Tail and gives it back
+ * by moving Tail. The slots are reused, so strings in them keep their
+ * memory. Only a thread that has to wait, on an empty or a full ring,
+ * takes the mutex to sleep on; the other side wakes it when it moves.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_RING_H
+#define XMACRO_RING_H
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+template <class Item, size_t Size>
+struct Ring {
+  static_assert ( ( Size & ( Size - 1 ) ) == 0, "the ring size must be a power of two" );
+
+  Item                    Slots[Size];
+  std::atomic<size_t>     Head { 0 };		// next slot to fill, moved by the producer
+  std::atomic<size_t>     Tail { 0 };		// next slot to use, moved by the consumer
+  std::atomic<bool>       Closed { false };	// the producer is done
+  std::atomic<int>        Sleepers { 0 };
+  std::mutex              Lock;
+  std::condition_variable Wake;
+};
+
+/****************************************************************************/
+/*! Returns the number of filled slots of \a R.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+inline size_t ringCount (const Ring<Item, Size> & R) {
+  return R.Head.load () - R.Tail.load ();
+}
+
+/****************************************************************************/
+/*! Sleeps until \a Ready returns true. It is looked at with the mutex held
+    and after announcing the sleep, so a wake up can not get lost.
+*/
+/****************************************************************************/
+template <class Item, size_t Size, class Cond>
+void ringSleep (Ring<Item, Size> & R, Cond Ready) {
+
+  std::unique_lock<std::mutex> Guard ( R.Lock );
+
+  R.Sleepers++;
+  R.Wake.wait ( Guard, Ready );
+  R.Sleepers--;
+}
+
+/****************************************************************************/
+/*! Wakes the other side of \a R if it sleeps. Costs one atomic load if not.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringWake (Ring<Item, Size> & R) {
+
+  if ( ! R.Sleepers.load () ) return;
+
+  std::lock_guard<std::mutex> Guard ( R.Lock );
+  R.Wake.notify_all ();
+}
+
+/****************************************************************************/
+/*! Returns the slot the producer fills next, or 0 if the ring is full.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+Item * ringTrySlot (Ring<Item, Size> & R) {
+
+  size_t Head = R.Head.load ( std::memory_order_relaxed );
+
+  if ( Head - R.Tail.load ( std::memory_order_acquire ) == Size ) return 0;
+  return &R.Slots[Head & ( Size - 1 )];
+}
+
+/****************************************************************************/
+/*! Returns the slot the producer fills next, waiting while the ring is
+    full.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+Item * ringSlot (Ring<Item, Size> & R) {
+
+  Item * Slot = ringTrySlot ( R );
+
+  if ( ! Slot ) {
+	ringSleep ( R, [&R] { return R.Head.load () - R.Tail.load () < Size; } );
+	Slot = ringTrySlot ( R );
+  }
+  return Slot;
+}
+
+/****************************************************************************/
+/*! Publishes the slot filled by the producer.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringPush (Ring<Item, Size> & R) {
+
+  R.Head.fetch_add ( 1 );
+  ringWake ( R );
+}
+
+/****************************************************************************/
+/*! Publishes the slot filled by the producer without waking the consumer,
+    for consumers that don't sleep until the ring has anything in it. The
+	producer decides when to call ringWake().
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringPost (Ring<Item, Size> & R) {
+
+  R.Head.fetch_add ( 1 );
+}
+
+/****************************************************************************/
+/*! Tells the consumer that nothing follows.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringClose (Ring<Item, Size> & R) {
+
+  R.Closed.store ( true );
+  ringWake ( R );
+}
+
+/****************************************************************************/
+/*! Returns the slot the consumer uses next, or 0 if the ring is empty.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+Item * ringPeek (Ring<Item, Size> & R) {
+
+  size_t Tail = R.Tail.load ( std::memory_order_relaxed );
+
+  if ( R.Head.load ( std::memory_order_acquire ) == Tail ) return 0;
+  return &R.Slots[Tail & ( Size - 1 )];
+}
+
+/****************************************************************************/
+/*! Returns the slot the consumer uses next, waiting while the ring is
+    empty. Returns 0 when the ring is empty and closed.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+Item * ringWait (Ring<Item, Size> & R) {
+
+  Item * Slot = ringPeek ( R );
+
+  if ( ! Slot ) {
+	ringSleep ( R, [&R] { return R.Head.load () != R.Tail.load () || R.Closed.load (); } );
+	Slot = ringPeek ( R );
+  }
+  return Slot;
+}
+
+/****************************************************************************/
+/*! Gives the slot used by the consumer back to the producer.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringPop (Ring<Item, Size> & R) {
+
+  R.Tail.fetch_add ( 1 );
+  ringWake ( R );
+}
+
+/****************************************************************************/
+/*! Returns how many filled slots follow, in memory, the one the consumer
+    uses next and sets \a First to it. If there are more, they go on from
+	the first slot. For consumers using many slots at once, which they give
+	back with ringPopMany().
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+size_t ringSpan (Ring<Item, Size> & R, Item *& First) {
+
+  size_t Tail = R.Tail.load ( std::memory_order_relaxed );
+  size_t Count = R.Head.load ( std::memory_order_acquire ) - Tail;
+  size_t Index = Tail & ( Size - 1 );
+
+  First = &R.Slots[Index];
+  return Count < Size - Index ? Count : Size - Index;
+}
+
+/****************************************************************************/
+/*! Gives the next \a Count slots used by the consumer back to the producer.
+*/
+/****************************************************************************/
+template <class Item, size_t Size>
+void ringPopMany (Ring<Item, Size> & R, size_t Count) {
+
+  R.Tail.fetch_add ( Count );
+  ringWake ( R );
+}
+
+#endif
@@ -0,0 +1,295 @@
+/*****************************************************************************
+ *
+ * trace.cpp - the trace log of the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ring.h"
+#include "trace.h"
+
+/*****************************************************************************
+ * Every thread that traces gets a ring of TraceRingSize records. The
+ * background thread sleeps until records come in and empties the rings
+ * TraceInterval microseconds later, so they are written in batches; with
+ * nothing traced it does not wake up at all.
+ ****************************************************************************/
+const size_t    TraceRingSize = 4096;
+const long long TraceInterval = 10000;
+
+struct TraceBuffer {
+  Ring<TraceRecord, TraceRingSize> Records;
+  std::atomic<unsigned long>       Dropped { 0 };
+};
+
+/*****************************************************************************
+ * Globals...
+ ****************************************************************************/
+int TraceLevel = TraceOff;
+
+static FILE *                      TraceFile = 0;
+static struct timespec             TraceStart;
+static std::mutex                  BuffersLock;
+static std::vector<TraceBuffer *>  Buffers;
+static std::thread                 Drainer;
+static std::atomic<bool>           Stopping { false };
+static std::atomic<int>            Sleeping { 0 };		// the drainer waits for records
+static std::mutex                  IdleLock;
+static std::condition_variable     Idle;
+static thread_local TraceBuffer *  Mine = 0;
+
+static const char LevelLetters[] = "-WIED";
+
+/****************************************************************************/
+/*! Appends the record \a r to \a Out as a line: the time, the level, the
+    source, the name and the numbers and text of the record.
+*/
+/****************************************************************************/
+static void printRecord (const TraceRecord & r, std::string & Out) {
+
+  char Line[128];
+  size_t i;
+
+  snprintf ( Line, sizeof (Line), "%6llu.%06llu %c%u %s",
+			 (unsigned long long)( r.Stamp / 1000000000 ),
+			 (unsigned long long)( r.Stamp / 1000 % 1000000 ), LevelLetters[r.Level],
+			 r.Source, r.Name );
+  Out += Line;
+
+  switch ( r.Args ) {
+	case TraceOneArg:  snprintf ( Line, sizeof (Line), " %d", r.A ); break;
+	case TraceTwoArgs: snprintf ( Line, sizeof (Line), " %d %d", r.A, r.B ); break;
+	case TraceSeconds: snprintf ( Line, sizeof (Line), " %d.%06ds", r.A, r.B ); break;
+	default:           Line[0] = 0;
+  }
+  Out += Line;
+
+  if ( r.Size ) {
+	Out += ' ';
+	// a line per record, whatever the text has in it
+	for ( i = 0; i < r.Len; i++ )
+	  Out += (unsigned char) r.Text[i] < ' ' ? '.' : r.Text[i];
+	if ( r.Size > r.Len ) {
+	  snprintf ( Line, sizeof (Line), "... (%u bytes)", r.Size );
+	  Out += Line;
+	}
+  }
+
+  Out += '\n';
+}
+
+/****************************************************************************/
+/*! Writes out what the rings hold now, in one write.
+*/
+/****************************************************************************/
+static void drain () {
+
+  std::lock_guard<std::mutex> Guard ( BuffersLock );
+  static std::string Out;
+  TraceRecord * r;
+  unsigned long Dropped;
+  size_t i;
+
+  for ( i = 0; i < Buffers.size (); i++ ) {
+	while ( ( r = ringPeek ( Buffers[i]->Records ) ) ) {
+	  printRecord ( *r, Out );
+	  ringPop ( Buffers[i]->Records );
+	}
+	if ( ( Dropped = Buffers[i]->Dropped.exchange ( 0 ) ) )
+	  Out += "trace: " + std::to_string ( Dropped ) + " records dropped\n";
+  }
+
+  if ( Out.empty () ) return;
+  fwrite ( Out.data (), 1, Out.size (), TraceFile );
+  fflush ( TraceFile );
+  Out.clear ();
+}
+
+/****************************************************************************/
+/*! Returns true if a ring holds records.
+*/
+/****************************************************************************/
+static bool traced () {
+
+  std::lock_guard<std::mutex> Guard ( BuffersLock );
+  size_t i;
+
+  for ( i = 0; i < Buffers.size (); i++ )
+	if ( ringCount ( Buffers[i]->Records ) ) return true;
+  return false;
+}
+
+/****************************************************************************/
+/*! Wakes the background thread if it sleeps, like ringWake() does for the
+    rings. Costs one atomic load if not.
+*/
+/****************************************************************************/
+static void wakeDrainer () {
+
+  if ( ! Sleeping.load () ) return;
+
+  std::lock_guard<std::mutex> Guard ( IdleLock );
+  Idle.notify_one ();
+}
+
+/****************************************************************************/
+/*! The background thread: drains the rings until traceClose().
+*/
+/****************************************************************************/
+static void drainLoop () {
+
+  struct timespec Pause = { 0, TraceInterval * 1000 };
+  sigset_t All;
+
+  // signals are for the threads of the program, not for us
+  sigfillset ( &All );
+  pthread_sigmask ( SIG_BLOCK, &All, 0 );
+
+  while ( ! Stopping.load () ) {
+	// as in ringSleep(), the sleep is announced before looking at the
+	// rings, so a record can not slip by unnoticed
+	{
+	  std::unique_lock<std::mutex> Guard ( IdleLock );
+
+	  Sleeping++;
+	  Idle.wait ( Guard, [] { return Stopping.load () || traced (); } );
+	  Sleeping--;
+	}
+
+	nanosleep ( &Pause, 0 );
+	drain ();
+  }
+  drain ();
+}
+
+/****************************************************************************/
+/*! Starts tracing records up to \a Level to the file \a Path, or to the
+    standard error if it is 0. Returns false if the file can't be opened.
+
+    \arg const char * Path - the trace file, or 0.
+	\arg int Level - the highest level traced.
+*/
+/****************************************************************************/
+bool traceOpen (const char * Path, int Level) {
+
+  TraceFile = Path ? fopen ( Path, "w" ) : stderr;
+  if ( ! TraceFile ) return false;
+
+  clock_gettime ( CLOCK_MONOTONIC, &TraceStart );
+  TraceLevel = Level;
+  if ( Level > TraceOff ) {
+	Drainer = std::thread ( drainLoop );
+	// whatever way the program ends, the rest is written and the thread
+	// joined before it is destroyed
+	atexit ( traceClose );
+  }
+  return true;
+}
+
+/****************************************************************************/
+/*! Writes out the rest of the records and stops tracing. The threads that
+    traced must be done. Called at exit too, a second call does nothing.
+*/
+/****************************************************************************/
+void traceClose () {
+
+  size_t i;
+
+  TraceLevel = TraceOff;
+  if ( Drainer.joinable () ) {
+	Stopping.store ( true );
+	wakeDrainer ();
+	Drainer.join ();
+  }
+
+  for ( i = 0; i < Buffers.size (); i++ ) delete Buffers[i];
+  Buffers.clear ();
+  Mine = 0;
+
+  if ( TraceFile && TraceFile != stderr ) fclose ( TraceFile );
+  TraceFile = 0;
+}
+
+/****************************************************************************/
+/*! Returns the level called \a Name (or given as a number), or -1.
+*/
+/****************************************************************************/
+int traceLevelByName (const char * Name) {
+
+  const char * Names[] = { "off", "warn", "info", "event", "debug" };
+  int i;
+
+  for ( i = 0; i <= TraceDebug; i++ )
+	if ( ! strcmp ( Name, Names[i] ) ) return i;
+  if ( Name[0] >= '0' && Name[0] <= '0' + TraceDebug && ! Name[1] ) return Name[0] - '0';
+  return -1;
+}
+
+/****************************************************************************/
+/*! Stores a record in the ring of the calling thread, which is created the
+    first time. Use trace() or traceText() instead, they don't get here for
+	levels not traced.
+*/
+/****************************************************************************/
+void traceWrite (int Level, int Source, const char * Name, int Args, int32_t A, int32_t B,
+				 const char * Text, size_t Len) {
+
+  struct timespec Now;
+  TraceRecord * r;
+
+  if ( ! Mine ) {
+	// zeroed, so the pages are there before the first records go in
+	Mine = new TraceBuffer ();
+	std::lock_guard<std::mutex> Guard ( BuffersLock );
+	Buffers.push_back ( Mine );
+  }
+
+  if ( ! ( r = ringTrySlot ( Mine->Records ) ) ) {
+	Mine->Dropped++;
+	return;
+  }
+
+  clock_gettime ( CLOCK_MONOTONIC, &Now );
+  r->Stamp  = ( Now.tv_sec - TraceStart.tv_sec ) * 1000000000ULL + Now.tv_nsec - TraceStart.tv_nsec;
+  r->Name   = Name;
+  r->A      = A;
+  r->B      = B;
+  r->Size   = Len;
+  r->Level  = Level;
+  r->Source = Source;
+  r->Args   = Args;
+  r->Len    = Len < TraceTextSize ? Len : TraceTextSize;
+  if ( Len ) memcpy ( r->Text, Text, r->Len );
+
+  // nobody sleeps on the ring itself, the drainer waits for all of them
+  ringPost ( Mine->Records );
+  wakeDrainer ();
+}
@@ -0,0 +1,98 @@
+/*****************************************************************************
+ *
+ * trace.h is the trace log of the xmacro utilities
+ *
+ * Tracing a command only stores a small binary record in a ring of the
+ * calling thread: a timestamp, the name (a string that lives as long as
+ * the program), up to two numbers and the start of a text. A background
+ * thread formats the records and writes them out, so the thread doing the
+ * work never waits for a write. Records that don't fit in a full ring are
+ * counted and dropped. Below the level asked for, a trace costs a compare.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_TRACE_H
+#define XMACRO_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum TraceLevel {
+  TraceOff = 0,
+  TraceWarn,			// things the user should know about
+  TraceInfo,			// progress
+  TraceEvent,			// every played or recorded command
+  TraceDebug
+};
+
+/*****************************************************************************
+ * How the numbers of a record are printed: not at all, one or both of
+ * them, or as seconds and microseconds.
+ ****************************************************************************/
+enum TraceArgs {
+  TraceNoArgs = 0,
+  TraceOneArg,
+  TraceTwoArgs,
+  TraceSeconds
+};
+
+const size_t TraceTextSize = 32;
+
+struct TraceRecord {
+  uint64_t     Stamp;			// nanoseconds since traceOpen()
+  const char * Name;
+  int32_t      A, B;
+  uint32_t     Size;			// length of the whole text
+  uint8_t      Level, Source, Args, Len;
+  char         Text[TraceTextSize];	// the first Len bytes of the text
+};
+
+extern int TraceLevel;
+
+bool traceOpen (const char * Path, int Level);
+void traceClose ();
+int  traceLevelByName (const char * Name);
+void traceWrite (int Level, int Source, const char * Name, int Args, int32_t A, int32_t B,
+				 const char * Text, size_t Len);
+
+/****************************************************************************/
+/*! Returns true if records of \a Level are traced.
+*/
+/****************************************************************************/
+inline bool tracing (int Level) {
+  return Level <= TraceLevel;
+}
+
+/****************************************************************************/
+/*! Traces \a Name with \a Args of the numbers \a A and \a B. \a Source tells
+    apart the displays or other sources of the same program.
+*/
+/****************************************************************************/
+inline void trace (int Level, int Source, const char * Name, int Args = TraceNoArgs,
+				   int32_t A = 0, int32_t B = 0) {
+  if ( tracing ( Level ) ) traceWrite ( Level, Source, Name, Args, A, B, 0, 0 );
+}
+
+/****************************************************************************/
+/*! Traces \a Name with the \a Len bytes of text at \a Text. Only the first
+    TraceTextSize bytes are kept.
+*/
+/****************************************************************************/
+inline void traceText (int Level, int Source, const char * Name, const char * Text, size_t Len) {
+  if ( tracing ( Level ) ) traceWrite ( Level, Source, Name, TraceNoArgs, 0, 0, Text, Len );
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*****************************************************************************
+ *
+ * window.cpp - finds windows by title or class for the xmacro utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <fnmatch.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+
+#include "window.h"
+
+/*****************************************************************************
+ * How deep below a window its names are looked for: the frame of the
+ * window manager, maybe a decoration window and then the client.
+ ****************************************************************************/
+const int MatchDepth = 2;
+
+/*****************************************************************************
+ * The error handler that was installed before ours
+ ****************************************************************************/
+static XErrorHandler NextHandler = 0;
+
+/****************************************************************************/
+/*! Ignores the errors caused by windows vanishing while we look at them,
+    all other errors go to the previous handler.
+*/
+/****************************************************************************/
+static int vanishedWindow (Display * Dpy, XErrorEvent * Error) {
+
+  if ( Error->error_code == BadWindow ) return 0;
+  return NextHandler ? NextHandler ( Dpy, Error ) : 0;
+}
+
+/****************************************************************************/
+/*! Installs an error handler ignoring BadWindow errors, so windows that are
+    destroyed while being matched don't end the program.
+*/
+/****************************************************************************/
+void ignoreVanishedWindows () {
+
+  if ( ! NextHandler ) NextHandler = XSetErrorHandler ( vanishedWindow );
+}
+
+/****************************************************************************/
+/*! Returns the text property \a Name of \a W, or 0. The result must be
+    freed with XFree().
+*/
+/****************************************************************************/
+static char * textProperty (Display * Dpy, Window W, Atom Name) {
+
+  Atom Type;
+  int Format;
+  unsigned long Count, After;
+  unsigned char * Data = 0;
+
+  if ( XGetWindowProperty ( Dpy, W, Name, 0, 1024, False, AnyPropertyType, &Type,
+						   &Format, &Count, &After, &Data ) != Success )
+	return 0;
+  if ( Data && Format != 8 ) {
+	XFree ( Data );
+	return 0;
+  }
+  return (char *) Data;
+}
+
+/****************************************************************************/
+/*! Returns true if the title or the class of \a W itself matches
+    \a Pattern.
+*/
+/****************************************************************************/
+static bool namesMatch (Display * Dpy, Window W, const char * Pattern) {
+
+  Atom NetName = XInternAtom ( Dpy, "_NET_WM_NAME", False );
+  XClassHint Class;
+  char * Name;
+  bool Match = false;
+
+  if ( ( Name = textProperty ( Dpy, W, NetName ) ) ) {
+	Match = fnmatch ( Pattern, Name, 0 ) == 0;
+	XFree ( Name );
+  }
+  if ( ! Match && ( Name = textProperty ( Dpy, W, XA_WM_NAME ) ) ) {
+	Match = fnmatch ( Pattern, Name, 0 ) == 0;
+	XFree ( Name );
+  }
+  if ( ! Match && XGetClassHint ( Dpy, W, &Class ) ) {
+	Match = ( Class.res_name && fnmatch ( Pattern, Class.res_name, 0 ) == 0 )
+	  || ( Class.res_class && fnmatch ( Pattern, Class.res_class, 0 ) == 0 );
+	if ( Class.res_name ) XFree ( Class.res_name );
+	if ( Class.res_class ) XFree ( Class.res_class );
+  }
+
+  return Match;
+}
+
+/****************************************************************************/
+/*! Looks for a window matching \a Pattern from \a W down to \a Depth levels
+    below it.
+*/
+/****************************************************************************/
+static bool treeMatches (Display * Dpy, Window W, const char * Pattern, int Depth) {
+
+  Window Root, Parent, * Children;
+  unsigned int Count, i;
+  bool Match;
+
+  if ( namesMatch ( Dpy, W, Pattern ) ) return true;
+  if ( ! Depth || ! XQueryTree ( Dpy, W, &Root, &Parent, &Children, &Count ) )
+	return false;
+
+  for ( Match = false, i = 0; i < Count && ! Match; i++ )
+	Match = treeMatches ( Dpy, Children[i], Pattern, Depth - 1 );
+  if ( Children ) XFree ( Children );
+  return Match;
+}
+
+/****************************************************************************/
+/*! Returns true if the top level window \a W, or the application window in
+    it, is called \a Pattern. An empty pattern matches every window.
+
+    \arg Display * Dpy - used display.
+	\arg Window W - the window, e.g. the frame of the window manager.
+	\arg const char * Pattern - shell pattern for the title or class.
+*/
+/****************************************************************************/
+bool windowMatches (Display * Dpy, Window W, const char * Pattern) {
+
+  if ( ! *Pattern ) return true;
+  return treeMatches ( Dpy, W, Pattern, MatchDepth );
+}
+
+/****************************************************************************/
+/*! Returns the viewable top level window on \a Root matching \a Pattern,
+    or None. The topmost one is returned if there are more.
+*/
+/****************************************************************************/
+Window findWindow (Display * Dpy, Window Root, const char * Pattern) {
+
+  Window Parent, * Children, Found = None;
+  XWindowAttributes Attr;
+  unsigned int Count, i;
+
+  if ( ! XQueryTree ( Dpy, Root, &Root, &Parent, &Children, &Count ) ) return None;
+
+  for ( i = Count; i-- > 0 && Found == None; ) {
+	if ( ! XGetWindowAttributes ( Dpy, Children[i], &Attr )
+		 || Attr.map_state != IsViewable || Attr.c_class == InputOnly )
+	  continue;
+	if ( windowMatches ( Dpy, Children[i], Pattern ) ) Found = Children[i];
+  }
+
+  if ( Children ) XFree ( Children );
+  return Found;
+}
+
+/****************************************************************************/
+/*! Returns the active window: the _NET_ACTIVE_WINDOW of the window manager
+    if it announces one, else the window with the input focus.
+*/
+/****************************************************************************/
+Window activeWindow (Display * Dpy, Window Root) {
+
+  Atom Active = XInternAtom ( Dpy, "_NET_ACTIVE_WINDOW", False ), Type;
+  int Format, Revert;
+  unsigned long Count, After;
+  unsigned char * Data = 0;
+  Window W = None;
+
+  if ( XGetWindowProperty ( Dpy, Root, Active, 0, 1, False, XA_WINDOW, &Type,
+						   &Format, &Count, &After, &Data ) == Success
+	   && Data && Count == 1 && Format == 32 )
+	W = *(Window *) Data;
+  if ( Data ) XFree ( Data );
+
+  if ( W == None ) {
+	XGetInputFocus ( Dpy, &W, &Revert );
+	if ( W == PointerRoot ) W = None;
+  }
+
+  return W;
+}
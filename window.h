@@ -0,0 +1,36 @@
+/*****************************************************************************
+ *
+ * window.h finds the windows the WaitFor commands of the xmacro utilities
+ * wait for
+ *
+ * Windows are matched against a shell pattern (see fnmatch(3)) by their
+ * title (WM_NAME or _NET_WM_NAME) or by either part of their WM_CLASS.
+ * Window managers put the application windows into frames, so the children
+ * of a window are looked at too.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+#ifndef XMACRO_WINDOW_H
+#define XMACRO_WINDOW_H
+
+#include <X11/Xlib.h>
+
+void   ignoreVanishedWindows ();
+bool   windowMatches (Display * Dpy, Window W, const char * Pattern);
+Window findWindow (Display * Dpy, Window Root, const char * Pattern);
+Window activeWindow (Display * Dpy, Window Root);
+
+#endif
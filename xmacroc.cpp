@@ -0,0 +1,460 @@
+/*****************************************************************************
+ *
+ * xmacroc - a utility for compiling xmacro macros.
+ *
+ * Reads a macro in the text language understood by xmacroplay and writes
+ * it in the compiled format, which xmacroplay maps into memory and plays
+ * without any parsing. Given the keyboard mapping it will be played with,
+ * the keys are compiled to keycodes, so xmacroplay plays them without
+ * looking anything up either.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Do we have config.h?
+ ****************************************************************************/
+#ifdef HAVE_CONFIG
+#include "config.h"
+#endif
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <X11/Xlib.h>
+
+#include "macro.h"
+#include "keymap.h"
+#include "chartbl.h"
+
+#define PROG "xmacroc"
+
+/*****************************************************************************
+ * Globals...
+ ****************************************************************************/
+char * Input = 0;
+char * Output = 0;
+
+/*****************************************************************************
+ * Specialize the macro for a keyboard mapping, read from a dump of
+ * 'xmodmap -pke' or fetched from a display? The modifiers a character of a
+ * String needs are held as xmacroplay holds them (Shift and AltGr).
+ ****************************************************************************/
+char * KeyMapPath = 0;
+char * KeyMapDisplay = 0;
+
+/*****************************************************************************
+ * The '-c' and '--paste-threshold' xmacroplay will be run with: the keysyms
+ * of the 8 bit character set of Strings (0 for UTF-8), and the length from
+ * which it pastes a UTF-8 String instead of typing it (0 for never).
+ ****************************************************************************/
+const KeySym * Charset = 0;
+size_t PasteThreshold = 0;
+
+const unsigned char LevelShift = 1;
+const unsigned char LevelThird = 2;
+
+using namespace std;
+
+/****************************************************************************/
+/*! Prints the usage, i.e. how the program is used. Exits the application with
+    the passed exit-code.
+
+	\arg const int ExitCode - the exitcode to use for exiting.
+*/
+/****************************************************************************/
+void usage (const int exitCode) {
+
+  // print the usage
+  cerr << PROG << " " << VERSION << endl;
+  cerr << "Usage: " << PROG << " [options] [input]" << endl;
+  cerr << "Options: " << endl;
+  cerr << "  -o  FILE    write the compiled macro to FILE. Default: stdout." << endl
+	   << "  --keymap FILE" << endl
+	   << "              compile the keys to keycodes of the keyboard mapping" << endl
+	   << "              dumped to FILE by 'xmodmap -pke'." << endl
+	   << "  --display DISPLAY" << endl
+	   << "              compile the keys to keycodes of the keyboard mapping" << endl
+	   << "              of DISPLAY." << endl
+	   << "  -c  CHARSET character set of Strings, as given to xmacroplay: utf-8," << endl
+	   << "              latin1 or latin2. Default: utf-8." << endl
+	   << "  --paste-threshold N" << endl
+	   << "              leave Strings of N bytes or more to be pasted, as" << endl
+	   << "              xmacroplay is told with the same option." << endl
+	   << "  -v          show version. " << endl
+	   << "  -h          this help. " << endl << endl;
+
+  // we're done
+  exit ( exitCode );
+}
+
+
+/****************************************************************************/
+/*! Prints the version of the application and exits.
+*/
+/****************************************************************************/
+void version () {
+
+  // print the version
+  cerr << PROG << " " << VERSION << endl;
+
+  // we're done
+  exit ( EXIT_SUCCESS );
+}
+
+
+/****************************************************************************/
+/*! Parses the commandline and stores all data in globals. Exits the
+    application with a failed exitcode if a parameter is illegal.
+
+	\arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+void parseCommandLine (int argc, char * argv[]) {
+
+  int Index = 1;
+
+  while ( Index < argc ) {
+
+	// is this '-v'?
+	if ( strcmp (argv[Index], "-v" ) == 0 ) {
+	  // yep, show version and exit
+	  version ();
+	}
+
+	// is this '-h'?
+	if ( strcmp (argv[Index], "-h" ) == 0 ) {
+	  // yep, show usage and exit
+	  usage ( EXIT_SUCCESS );
+	}
+
+	// is this '-o'?
+	else if ( strcmp (argv[Index], "-o" ) == 0 && Index + 1 < argc ) {
+	  Output = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '--keymap'?
+	else if ( strcmp (argv[Index], "--keymap" ) == 0 && Index + 1 < argc ) {
+	  // yep, specialize for the mapping dumped there
+	  KeyMapPath = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '--display'?
+	else if ( strcmp (argv[Index], "--display" ) == 0 && Index + 1 < argc ) {
+	  // yep, specialize for the mapping of that display
+	  KeyMapDisplay = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '-c'?
+	else if ( strcmp (argv[Index], "-c" ) == 0 && Index + 1 < argc ) {
+	  // yep, look the character set up by name
+	  size_t i = 0, n = sizeof (Charsets) / sizeof (Charsets[0]);
+
+	  while ( i < n && strcmp ( argv[Index + 1], Charsets[i].Name ) != 0 ) i++;
+	  if ( i < n ) Charset = Charsets[i].Table;
+	  else if ( strcmp ( argv[Index + 1], "utf-8" ) == 0 ) Charset = 0;
+	  else {
+		cerr << "Invalid parameter for '-c'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--paste-threshold'?
+	else if ( strcmp (argv[Index], "--paste-threshold" ) == 0 && Index + 1 < argc ) {
+	  // yep, and there seems to be a parameter too, interpret it as a
+	  // number
+	  if ( sscanf ( argv[Index + 1], "%zu", &PasteThreshold ) != 1 ) {
+		cerr << "Invalid parameter for '--paste-threshold'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this the last parameter?
+	else if ( Index == argc - 1 && argv[Index][0] != '-' ) {
+	  // yep, we assume it's the input file
+	  Input = argv[Index];
+	}
+
+	else {
+	  // we got this far, the parameter is no good...
+	  cerr << "Invalid parameter '" << argv[Index] << "'." << endl;
+	  usage ( EXIT_FAILURE );
+	}
+
+	// next value
+	Index++;
+  }
+}
+
+/****************************************************************************/
+/*! Compiles the text macro read from \a Fd into \a Out. Returns the number
+    of events compiled.
+*/
+/****************************************************************************/
+uint32_t compile (int Fd, string & Out) {
+
+  MacroReader Reader;
+  uint32_t Count;
+
+  openMacroReader ( Reader, Fd );
+  Count = compileMacro ( Reader, Out );
+  closeMacroReader ( Reader );
+  return Count;
+}
+
+
+/****************************************************************************/
+/*! Loads the keyboard mapping to specialize for into \a Map, from the dump
+    or the display. Exits if it can't.
+*/
+/****************************************************************************/
+void loadTargetKeyMap (KeyMap & Map) {
+
+  Display * Dpy;
+
+  if ( KeyMapPath ) {
+	if ( ! readKeyMapDump ( KeyMapPath, Map ) ) {
+	  cerr << PROG << ": could not read a keyboard mapping from \"" << KeyMapPath
+		   << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+	return;
+  }
+
+  if ( ! ( Dpy = XOpenDisplay ( KeyMapDisplay ) ) ) {
+	cerr << PROG << ": could not open display \"" << KeyMapDisplay << "\", aborting." << endl;
+	exit ( EXIT_FAILURE );
+  }
+  loadKeyMap ( Dpy, Map );
+  XCloseDisplay ( Dpy );
+}
+
+/****************************************************************************/
+/*! Appends the command \a Op for the keycode \a kc to \a Out and counts it.
+*/
+/****************************************************************************/
+void appendKeyCode (string & Out, int Op, KeyCode kc, uint32_t & Count) {
+
+  MacroEvent ev;
+
+  memset ( &ev, 0, sizeof (ev) );
+  ev.Op = Op;
+  ev.A = kc;
+  appendMacroEvent ( Out, ev, 0 );
+  Count++;
+}
+
+/****************************************************************************/
+/*! Appends the presses and releases of the modifiers of \a Map that change
+    the levels held from \a Held to \a Need.
+*/
+/****************************************************************************/
+void holdLevels (const KeyMap & Map, unsigned char & Held, unsigned char Need,
+				 string & Out, uint32_t & Count) {
+
+  if ( ( Held ^ Need ) & LevelShift )
+	appendKeyCode ( Out, Need & LevelShift ? OpKeyCodePress : OpKeyCodeRelease, Map.ShiftCode, Count );
+  if ( ( Held ^ Need ) & LevelThird )
+	appendKeyCode ( Out, Need & LevelThird ? OpKeyCodePress : OpKeyCodeRelease, Map.Level3Code, Count );
+
+  Held = Need;
+}
+
+/****************************************************************************/
+/*! Appends the key events typing the String \a Text of \a Len bytes on
+    the mapping \a Map to \a Out, the same xmacroplay sends for it. The
+	String is in the character set chosen with '-c'. Returns false,
+	appending nothing, if a character is not on the mapping; xmacroplay
+	binds those to spare keycodes while playing.
+*/
+/****************************************************************************/
+bool specializeString (const KeyMap & Map, const char * Text, size_t Len,
+					   string & Out, uint32_t & Count) {
+
+  const unsigned char * p = (const unsigned char *) Text, * End = p + Len;
+  const KeyMapEntry * e;
+  unsigned char Held = 0, Need;
+  uint32_t Added = 0;
+  string Keys;
+  KeySym ks;
+
+  while ( p < End && *p ) {
+	ks = Charset ? Charset[*p++] : charToKeysym ( Map, decodeUtf8 ( p, End ) );
+	if ( ks == NoSymbol ) continue;
+	// a keysym only in another group is bound to a spare by xmacroplay
+	if ( ! ( e = lookupKeySym ( Map, ks ) ) || e->Group ) return false;
+
+	// level 2 is Shift, level 3 AltGr and level 4 both of them
+	Need = ( e->Level & 1 ? LevelShift : 0 ) | ( e->Level & 2 ? LevelThird : 0 );
+	// without the modifier xmacroplay leaves the character out
+	if ( ( ( Need & LevelShift ) && ! Map.ShiftCode )
+		 || ( ( Need & LevelThird ) && ! Map.Level3Code ) )
+	  continue;
+
+	holdLevels ( Map, Held, Need, Keys, Added );
+	appendKeyCode ( Keys, OpKeyCodePress, e->Code, Added );
+	appendKeyCode ( Keys, OpKeyCodeRelease, e->Code, Added );
+  }
+  holdLevels ( Map, Held, 0, Keys, Added );
+
+  Out += Keys;
+  Count += Added;
+  return true;
+}
+
+/****************************************************************************/
+/*! Rewrites the compiled macro \a Image for the keyboard mapping \a Map into
+    \a Out: keysyms become the keycodes producing them and Strings the key
+	events typing them. It starts with a KeyMap command holding the
+	fingerprint of \a Map, which xmacroplay checks. Keys not on the mapping
+	and Strings xmacroplay will paste are left as they are. Returns the
+	number of events in \a Out.
+*/
+/****************************************************************************/
+uint32_t specialize (const KeyMap & Map, const string & Image, string & Out) {
+
+  MacroFile File;
+  const MacroEvent * ev;
+  MacroEvent Stamp;
+  uint64_t Fingerprint = keyMapFingerprint ( Map );
+  uint32_t Count = 0;
+  unsigned long Keys = 0, Strings = 0, Left = 0;
+  KeyCode kc;
+
+  bufferMacro ( Image.data (), Image.size (), File );
+  beginMacro ( Out );
+
+  memset ( &Stamp, 0, sizeof (Stamp) );
+  Stamp.Op = OpKeyMap;
+  Stamp.A = (int32_t)( Fingerprint & 0xffffffff );
+  Stamp.B = (int32_t)( Fingerprint >> 32 );
+  appendMacroEvent ( Out, Stamp, 0 );
+  Count++;
+
+  for ( ev = File.First; ev < File.End; ev = macroNext ( ev ) ) {
+	switch ( ev->Op ) {
+	  case OpKeySym:
+	  case OpKeySymPress:
+	  case OpKeySymRelease:
+	  case OpKeyStr:
+	  case OpKeyStrPress:
+	  case OpKeyStrRelease:
+		if ( ! ( kc = keysymToKeycode ( Map, (KeySym)(uint32_t) ev->A ) ) ) {
+		  cerr << "Keysym " << ev->A << " is not on the keyboard mapping, left as it is." << endl;
+		  Left++;
+		  break;
+		}
+		// the plain commands press and release, as xmacroplay does
+		if ( ev->Op != OpKeySymRelease && ev->Op != OpKeyStrRelease )
+		  appendKeyCode ( Out, OpKeyCodePress, kc, Count );
+		if ( ev->Op != OpKeySymPress && ev->Op != OpKeyStrPress )
+		  appendKeyCode ( Out, OpKeyCodeRelease, kc, Count );
+		Keys++;
+		continue;
+
+	  case OpString:
+		// xmacroplay pastes only UTF-8 Strings
+		if ( PasteThreshold && ! Charset && ev->Len >= PasteThreshold ) break;
+		if ( specializeString ( Map, macroPayload ( ev ), ev->Len, Out, Count ) ) {
+		  Strings++;
+		  continue;
+		}
+		cerr << "String has characters not on the keyboard mapping, left as it is." << endl;
+		Left++;
+		break;
+
+	  case OpKeyMap:
+		// the macro is stamped anew
+		continue;
+	}
+
+	appendMacroEvent ( Out, *ev, ev->Len ? macroPayload ( ev ) : 0 );
+	Count++;
+  }
+
+  finishMacro ( Out, Count );
+
+  cerr << PROG << ": specialized " << Keys << " keys and " << Strings
+	   << " Strings for the keyboard mapping " << hex << setfill ('0') << setw (16)
+	   << Fingerprint << dec << setfill (' ') << ", " << Left << " left to look up." << endl;
+  return Count;
+}
+
+/****************************************************************************/
+/*! Main function of the application.
+
+    \arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+int main (int argc, char * argv[]) {
+
+  string Out, Image;
+  uint32_t Count;
+  KeyMap Map;
+
+  // parse commandline arguments
+  parseCommandLine ( argc, argv );
+
+  // the mapping is there before the macro is read
+  if ( KeyMapPath || KeyMapDisplay ) loadTargetKeyMap ( Map );
+
+  if ( Input ) {
+	int Fd = open ( Input, O_RDONLY );
+	if ( Fd < 0 ) {
+	  cerr << PROG << ": could not open \"" << Input << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+	Count = compile ( Fd, Out );
+	close ( Fd );
+  }
+  else Count = compile ( 0, Out );
+
+  if ( KeyMapPath || KeyMapDisplay ) {
+	Image.swap ( Out );
+	Count = specialize ( Map, Image, Out );
+  }
+
+  if ( Output ) {
+	ofstream Of ( Output, ios::out | ios::binary | ios::trunc );
+	Of.write ( Out.data (), Out.size () );
+	if ( ! Of ) {
+	  cerr << PROG << ": could not write \"" << Output << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+  }
+  else cout.write ( Out.data (), Out.size () ).flush ();
+
+  cerr << PROG << ": " << Count << " events, " << Out.size () << " bytes." << endl;
+
+  // go away
+  exit ( EXIT_SUCCESS );
+}
@@ -0,0 +1,346 @@
+/*****************************************************************************
+ *
+ * xmacrodecode - a utility for decoding raw captures of xmacrorec2.
+ *
+ * Reads a capture written by 'xmacrorec2 --raw' and writes the macro it
+ * holds, in the text language or in the compiled format of xmacroc. The
+ * result is the same as what xmacrorec2 would have written itself.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Do we have config.h?
+ ****************************************************************************/
+#ifdef HAVE_CONFIG
+#include "config.h"
+#endif
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <X11/Xlib.h>
+
+#include "capture.h"
+#include "macro.h"
+#include "trace.h"
+
+#define PROG "xmacrodecode"
+
+/*****************************************************************************
+ * The records are read in blocks of this many.
+ ****************************************************************************/
+const size_t ReadRecords = 1024;
+
+/*****************************************************************************
+ * Globals...
+ ****************************************************************************/
+char * Input = 0;
+char * Output = 0;
+bool   Timing = false;
+bool   Compiled = false;
+
+/*****************************************************************************
+ * Drags are simplified to stay within Tolerance pixels of the path (0 keeps
+ * every point), with a point at least every Resolution ms.
+ ****************************************************************************/
+int      Tolerance = 0;
+uint32_t Resolution = DefaultResolution;
+
+using namespace std;
+
+/*****************************************************************************
+ * Where the decoded events go.
+ ****************************************************************************/
+struct Decoded {
+  string   Out;
+  uint32_t Count;
+};
+
+/****************************************************************************/
+/*! Prints the usage, i.e. how the program is used. Exits the application with
+    the passed exit-code.
+
+	\arg const int ExitCode - the exitcode to use for exiting.
+*/
+/****************************************************************************/
+void usage (const int exitCode) {
+
+  // print the usage
+  cerr << PROG << " " << VERSION << endl;
+  cerr << "Usage: " << PROG << " [options] [input]" << endl;
+  cerr << "Options: " << endl;
+  cerr << "  -t          emit Delay lines with the recorded timing." << endl
+	   << "  -b          write the compiled format instead of the text." << endl
+	   << "  --simplify PIXELS" << endl
+	   << "              keep only the points of a drag needed to stay within" << endl
+	   << "              PIXELS of its path. Default: every point." << endl
+	   << "  --resolution TIME" << endl
+	   << "              keep a point of a simplified drag at least every TIME." << endl
+	   << "              Default: 100ms, 0 for none." << endl
+	   << "  -o  FILE    write the macro to FILE. Default: stdout." << endl
+	   << "  -v          show version. " << endl
+	   << "  -h          this help. " << endl << endl;
+
+  // we're done
+  exit ( exitCode );
+}
+
+
+/****************************************************************************/
+/*! Prints the version of the application and exits.
+*/
+/****************************************************************************/
+void version () {
+
+  // print the version
+  cerr << PROG << " " << VERSION << endl;
+
+  // we're done
+  exit ( EXIT_SUCCESS );
+}
+
+
+/****************************************************************************/
+/*! Parses the commandline and stores all data in globals. Exits the
+    application with a failed exitcode if a parameter is illegal.
+
+	\arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+void parseCommandLine (int argc, char * argv[]) {
+
+  int Index = 1;
+  int32_t Sec, Usec;
+
+  while ( Index < argc ) {
+
+	// is this '-v'?
+	if ( strcmp (argv[Index], "-v" ) == 0 ) {
+	  // yep, show version and exit
+	  version ();
+	}
+
+	// is this '-h'?
+	if ( strcmp (argv[Index], "-h" ) == 0 ) {
+	  // yep, show usage and exit
+	  usage ( EXIT_SUCCESS );
+	}
+
+	// is this '-t'?
+	else if ( strcmp (argv[Index], "-t" ) == 0 ) {
+	  // yep, keep the timing of the events
+	  Timing = true;
+	}
+
+	// is this '-b'?
+	else if ( strcmp (argv[Index], "-b" ) == 0 ) {
+	  // yep, write what xmacroc would
+	  Compiled = true;
+	}
+
+	// is this '--simplify'?
+	else if ( strcmp (argv[Index], "--simplify" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the tolerance in pixels
+	  if ( sscanf ( argv[Index + 1], "%d", &Tolerance ) != 1 || Tolerance < 0 ) {
+		cerr << "Invalid parameter for '--simplify'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--resolution'?
+	else if ( strcmp (argv[Index], "--resolution" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a duration
+	  if ( ! parseDuration ( argv[Index + 1], Sec, Usec ) || Sec > 1000000 ) {
+		cerr << "Invalid parameter for '--resolution'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Resolution = Sec * 1000 + Usec / 1000;
+	  Index++;
+	}
+
+	// is this '-o'?
+	else if ( strcmp (argv[Index], "-o" ) == 0 && Index + 1 < argc ) {
+	  Output = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this the last parameter?
+	else if ( Index == argc - 1 && argv[Index][0] != '-' ) {
+	  // yep, we assume it's the input file
+	  Input = argv[Index];
+	}
+
+	else {
+	  // we got this far, the parameter is no good...
+	  cerr << "Invalid parameter '" << argv[Index] << "'." << endl;
+	  usage ( EXIT_FAILURE );
+	}
+
+	// next value
+	Index++;
+  }
+}
+
+/****************************************************************************/
+/*! Reads up to \a Size bytes from \a Fd into \a Buf. Returns how many it
+    got, less only at the end of the input, or -1 on errors.
+*/
+/****************************************************************************/
+ssize_t readFull (int Fd, void * Buf, size_t Size) {
+
+  size_t Done = 0;
+  ssize_t n;
+
+  while ( Done < Size ) {
+	if ( ( n = read ( Fd, (char *) Buf + Done, Size - Done ) ) < 0 ) {
+	  if ( errno == EINTR ) continue;
+	  return -1;
+	}
+	if ( n == 0 ) break;
+	Done += n;
+  }
+
+  return Done;
+}
+
+/****************************************************************************/
+/*! Appends the decoded event \a ev with its \a Payload to the output.
+*/
+/****************************************************************************/
+void emitDecoded (void * Arg, const MacroEvent & ev, const char * Payload) {
+
+  Decoded * d = (Decoded *) Arg;
+
+  if ( Compiled ) appendMacroEvent ( d->Out, ev, Payload );
+  else formatMacroEvent ( d->Out, ev, Payload );
+  d->Count++;
+}
+
+/****************************************************************************/
+/*! Decodes the capture read from \a Fd into \a d. Exits if it is not a
+    capture.
+*/
+/****************************************************************************/
+void decode (int Fd, Decoded & d) {
+
+  CaptureHeader Header;
+  vector<CaptureRecord> Records ( ReadRecords );
+  EventDecoder Dec;
+  KeyMap Keys;
+  ssize_t n;
+  size_t i, Broken = 0;
+
+  if ( readFull ( Fd, &Header, sizeof (Header) ) != sizeof (Header) || ! checkCapture ( Header ) ) {
+	cerr << PROG << ": the input is not a capture of xmacrorec2 --raw, aborting." << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  // no keycode has a keysym until the mapping is read
+  Keys.MinCode = 1;
+  Keys.MaxCode = 0;
+  Keys.PerCode = 0;
+
+  startDecoder ( Dec, Header.PointerX, Header.PointerY, Timing );
+  Dec.QuitKey = Dec.CheckKey = 0;
+  Dec.Keys = &Keys;
+  Dec.Emit = emitDecoded;
+  Dec.Arg = &d;
+  Dec.Tolerance = Tolerance;
+  Dec.Resolution = Resolution;
+
+  if ( Compiled ) beginMacro ( d.Out );
+  d.Count = 0;
+
+  while ( ( n = readFull ( Fd, &Records[0], Records.size () * sizeof (CaptureRecord) ) ) > 0 ) {
+	for ( i = 0; i < n / sizeof (CaptureRecord); i++ )
+	  if ( ! decodeRecord ( Dec, Records[i], Keys ) ) Broken++;
+
+	if ( n % sizeof (CaptureRecord) ) {
+	  cerr << PROG << ": the capture ends in the middle of a record." << endl;
+	  break;
+	}
+  }
+
+  finishDecoder ( Dec );
+
+  if ( n < 0 ) cerr << PROG << ": could not read the capture to the end." << endl;
+  if ( Broken ) cerr << PROG << ": " << Broken << " broken records skipped." << endl;
+  if ( Compiled ) finishMacro ( d.Out, d.Count );
+  if ( Tolerance && Dec.DragPoints )
+	cerr << PROG << ": simplified the drags to " << Dec.DragKept << " of " << Dec.DragPoints
+		 << " points, " << fixed << setprecision ( 1 )
+		 << (double) Dec.DragPoints / max ( Dec.DragKept, 1UL ) << ":1." << endl;
+}
+
+
+/****************************************************************************/
+/*! Main function of the application.
+
+    \arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+int main (int argc, char * argv[]) {
+
+  Decoded d;
+
+  // parse commandline arguments
+  parseCommandLine ( argc, argv );
+
+  // the decoder tells about the events it skips
+  traceOpen ( 0, TraceWarn );
+
+  if ( Input ) {
+	int Fd = open ( Input, O_RDONLY );
+	if ( Fd < 0 ) {
+	  cerr << PROG << ": could not open \"" << Input << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+	decode ( Fd, d );
+	close ( Fd );
+  }
+  else decode ( 0, d );
+
+  if ( Output ) {
+	ofstream Of ( Output, ios::out | ios::binary | ios::trunc );
+	Of.write ( d.Out.data (), d.Out.size () );
+	if ( ! Of ) {
+	  cerr << PROG << ": could not write \"" << Output << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+  }
+  else cout.write ( d.Out.data (), d.Out.size () ).flush ();
+
+  cerr << PROG << ": " << d.Count << " events, " << d.Out.size () << " bytes." << endl;
+
+  // go away
+  exit ( EXIT_SUCCESS );
+}
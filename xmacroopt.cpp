@@ -0,0 +1,311 @@
+/*****************************************************************************
+ *
+ * xmacroopt - a utility for optimizing macros.
+ *
+ * Reads a macro, text or compiled by xmacroc, and writes it with the
+ * waste of recording taken out (see optimize.h), in the text language or
+ * in the compiled format. Tells how many commands it saved and how much
+ * sooner the macro should play.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ ****************************************************************************/
+
+/*****************************************************************************
+ * Do we have config.h?
+ ****************************************************************************/
+#ifdef HAVE_CONFIG
+#include "config.h"
+#endif
+
+/*****************************************************************************
+ * Includes
+ ****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <X11/Xlib.h>
+
+#include "macro.h"
+#include "optimize.h"
+
+#define PROG "xmacroopt"
+
+/*****************************************************************************
+ * Globals...
+ ****************************************************************************/
+char * Input = 0;
+char * Output = 0;
+bool   Compiled = false;
+
+/*****************************************************************************
+ * The delay between events of xmacroplay ('-d'), in milliseconds, for
+ * estimating how long the macro plays.
+ ****************************************************************************/
+const int DefaultDelay = 10;
+
+int Delay = DefaultDelay;
+
+using namespace std;
+
+/****************************************************************************/
+/*! Prints the usage, i.e. how the program is used. Exits the application with
+    the passed exit-code.
+
+	\arg const int ExitCode - the exitcode to use for exiting.
+*/
+/****************************************************************************/
+void usage (const int exitCode) {
+
+  // print the usage
+  cerr << PROG << " " << VERSION << endl;
+  cerr << "Usage: " << PROG << " [options] [input]" << endl;
+  cerr << "Options: " << endl;
+  cerr << "  -b          write the compiled format instead of the text." << endl
+	   << "  -d  DELAY   estimate the replay time for 'xmacroplay -d DELAY'." << endl
+	   << "              Default: 10ms." << endl
+	   << "  -o  FILE    write the macro to FILE. Default: stdout." << endl
+	   << "  -v          show version. " << endl
+	   << "  -h          this help. " << endl << endl;
+
+  // we're done
+  exit ( exitCode );
+}
+
+
+/****************************************************************************/
+/*! Prints the version of the application and exits.
+*/
+/****************************************************************************/
+void version () {
+
+  // print the version
+  cerr << PROG << " " << VERSION << endl;
+
+  // we're done
+  exit ( EXIT_SUCCESS );
+}
+
+
+/****************************************************************************/
+/*! Parses the commandline and stores all data in globals. Exits the
+    application with a failed exitcode if a parameter is illegal.
+
+	\arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+void parseCommandLine (int argc, char * argv[]) {
+
+  int Index = 1;
+
+  while ( Index < argc ) {
+
+	// is this '-v'?
+	if ( strcmp (argv[Index], "-v" ) == 0 ) {
+	  // yep, show version and exit
+	  version ();
+	}
+
+	// is this '-h'?
+	if ( strcmp (argv[Index], "-h" ) == 0 ) {
+	  // yep, show usage and exit
+	  usage ( EXIT_SUCCESS );
+	}
+
+	// is this '-b'?
+	else if ( strcmp (argv[Index], "-b" ) == 0 ) {
+	  // yep, write what xmacroc would
+	  Compiled = true;
+	}
+
+	// is this '-d'?
+	else if ( strcmp (argv[Index], "-d" ) == 0 && Index + 1 < argc ) {
+	  // yep, the delay of xmacroplay in milliseconds
+	  if ( sscanf ( argv[Index + 1], "%d", &Delay ) != 1 || Delay < 0 ) {
+		cerr << "Invalid parameter for '-d'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '-o'?
+	else if ( strcmp (argv[Index], "-o" ) == 0 && Index + 1 < argc ) {
+	  Output = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this the last parameter?
+	else if ( Index == argc - 1 && argv[Index][0] != '-' ) {
+	  // yep, we assume it's the input file
+	  Input = argv[Index];
+	}
+
+	else {
+	  // we got this far, the parameter is no good...
+	  cerr << "Invalid parameter '" << argv[Index] << "'." << endl;
+	  usage ( EXIT_FAILURE );
+	}
+
+	// next value
+	Index++;
+  }
+}
+
+/****************************************************************************/
+/*! Appends the optimized command \a ev with its \a Payload to the output
+    at \a Arg.
+*/
+/****************************************************************************/
+void emitOptimized (void * Arg, const MacroEvent & ev, const char * Payload) {
+
+  string & Out = *(string *) Arg;
+
+  if ( Compiled ) appendMacroEvent ( Out, ev, Payload );
+  else formatMacroEvent ( Out, ev, Payload );
+}
+
+/****************************************************************************/
+/*! Optimizes the macro read from \a Fd, text or compiled, into \a Out and
+    tells in \a Stats what was done. Exits if it is a compiled macro we
+	can not read.
+*/
+/****************************************************************************/
+void optimize (int Fd, string & Out, OptimizeStats & Stats) {
+
+  MacroOptimizer O;
+  MacroReader Reader;
+  MacroFile File;
+  MacroEvent ev;
+  const MacroEvent * p;
+  const char * Text;
+
+  startOptimizer ( O );
+  O.Emit = emitOptimized;
+  O.Arg = &Out;
+
+  if ( Compiled ) beginMacro ( Out );
+
+  switch ( mapMacro ( Fd, File ) ) {
+	case 1:
+	  for ( p = File.First; p < File.End; p = macroNext ( p ) )
+		optimizeEvent ( O, *p, p->Len ? macroPayload ( p ) : 0 );
+	  unmapMacro ( File );
+	  break;
+
+	case -1:
+	  cerr << PROG << ": compiled macro is not version " << MacroVersion
+		   << " for this machine, recompile it with xmacroc." << endl;
+	  exit ( EXIT_FAILURE );
+
+	default:
+	  // what xmacroc would leave out is left out, comments are kept in
+	  // the text only, where nothing is combined across them
+	  openMacroReader ( Reader, Fd );
+	  while ( readMacroEvent ( Reader, ev, Text ) ) {
+		if ( ev.Op == OpComment && Compiled ) continue;
+		if ( ev.Op == OpUnknown ) {
+		  cerr << "Unknown tag: " << Text << endl;
+		  continue;
+		}
+		if ( ( ev.Op == OpKeyStr || ev.Op == OpKeyStrPress || ev.Op == OpKeyStrRelease )
+			 && ev.A == NoSymbol ) {
+		  cerr << "Unknown keysym name: " << Text << endl;
+		  continue;
+		}
+		optimizeEvent ( O, ev, Text );
+	  }
+	  closeMacroReader ( Reader );
+	  break;
+  }
+
+  finishOptimizer ( O );
+  if ( Compiled ) finishMacro ( Out, O.Stats.After );
+
+  Stats = O.Stats;
+}
+
+/****************************************************************************/
+/*! Prints \a Usec microseconds as seconds to the standard error.
+*/
+/****************************************************************************/
+void printSeconds (long long Usec) {
+
+  cerr << Usec / 1000000 << "." << setfill ('0') << setw (3) << Usec / 1000 % 1000
+	   << setfill (' ') << " s";
+}
+
+
+/****************************************************************************/
+/*! Main function of the application.
+
+    \arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+int main (int argc, char * argv[]) {
+
+  string Out;
+  OptimizeStats Stats;
+  long long Before, After;
+
+  // parse commandline arguments
+  parseCommandLine ( argc, argv );
+
+  if ( Input ) {
+	int Fd = open ( Input, O_RDONLY );
+	if ( Fd < 0 ) {
+	  cerr << PROG << ": could not open \"" << Input << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+	optimize ( Fd, Out, Stats );
+	close ( Fd );
+  }
+  else optimize ( 0, Out, Stats );
+
+  if ( Output ) {
+	ofstream Of ( Output, ios::out | ios::binary | ios::trunc );
+	Of.write ( Out.data (), Out.size () );
+	if ( ! Of ) {
+	  cerr << PROG << ": could not write \"" << Output << "\", aborting." << endl;
+	  exit ( EXIT_FAILURE );
+	}
+  }
+  else cout.write ( Out.data (), Out.size () ).flush ();
+
+  // every request waits the delay, the Delays wait the same as before
+  Before = Stats.DelayUsec + Stats.RequestsBefore * Delay * 1000LL;
+  After = Stats.DelayUsec + Stats.RequestsAfter * Delay * 1000LL;
+
+  cerr << PROG << ": " << Stats.Before << " commands before, " << Stats.After << " after." << endl
+	   << "  " << Stats.Motions << " motions dropped, " << Stats.Delays << " Delays merged, "
+	   << Stats.Pairs << " key presses joined with their release, " << Stats.Typed
+	   << " keys typed as " << Stats.Strings << " Strings." << endl
+	   << "  Estimated replay time with '-d " << Delay << "': ";
+  printSeconds ( Before );
+  cerr << " before, ";
+  printSeconds ( After );
+  cerr << " after, ";
+  printSeconds ( Before - After );
+  cerr << " saved." << endl;
+
+  // go away
+  exit ( EXIT_SUCCESS );
+}
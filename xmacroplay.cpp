@@ -38,6 +38,16 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <X11/Xlibint.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -45,8 +55,22 @@
 #include <X11/keysymdef.h>
 #include <X11/keysym.h>
 #include <X11/extensions/XTest.h>
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#include <xcb/xcbext.h>
+#endif
 
 #include "chartbl.h"
+#include "macro.h"
+#include "keymap.h"
+#include "optimize.h"
+#include "paste.h"
+#include "window.h"
+#include "region.h"
+#include "ring.h"
+#include "trace.h"
 /***************************************************************************** 
  * What iostream do we have?
  ****************************************************************************/
@@ -54,10 +78,15 @@
 #ifdef HAVE_IOSTREAM
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #else
 #include <iostream.h>
 #include <iomanip.h>
 #endif
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
 
 #define PROG "xmacroplay"
 
@@ -77,7 +106,217 @@ const float DefaultScale = 1.0;
  ****************************************************************************/
 int   Delay = DefaultDelay;
 float Scale = DefaultScale;
-char * Remote;
+char * Input = 0;
+
+/***************************************************************************** 
+ * The remote displays. With more than one the macro is fanned out to all
+ * of them, either free-running (a thread per display, each on its own
+ * timeline) or in lockstep (every command goes to all displays before the
+ * next one).
+ ****************************************************************************/
+std::vector<char *> Remotes;
+bool                Lockstep = false;
+
+/***************************************************************************** 
+ * Replay speed applied to the Delay commands, and the longest Delay waited
+ * for in microseconds (negative for no limit).
+ ****************************************************************************/
+float     Speed = 1.0;
+long long MaxGap = -1;
+
+/***************************************************************************** 
+ * Run the macro through the peephole optimizer (see optimize.h) before
+ * playing it? It is compiled first, so it is not played while being read.
+ ****************************************************************************/
+bool Optimize = false;
+
+/***************************************************************************** 
+ * Motion resampling: a run of MotionNotify commands (with the Delays
+ * between them) is taken as a path of the pointer over time and played at
+ * MotionRate points per second instead of point by point, the points in
+ * between interpolated along the path. 0 plays only where the path starts
+ * and ends, negative plays every motion as recorded.
+ ****************************************************************************/
+enum Interpolation {
+  InterpolateNone,		// the last recorded point, as it was at the time
+  InterpolateLinear,
+  InterpolateSpline		// Catmull-Rom through the recorded points
+};
+
+const int MaxMotionRate = 10000;
+
+int MotionRate = -1;
+int Interpolate = InterpolateLinear;
+
+struct PathPoint {
+  int       x, y;
+  long long Time;		// microseconds from the start of the path
+};
+
+/***************************************************************************** 
+ * The Unix socket of the daemon, either ours (Daemon) or the one we submit
+ * our macro to.
+ ****************************************************************************/
+char * Socket = 0;
+bool   Daemon = false;
+
+/***************************************************************************** 
+ * XTest requests are collected in the output buffer and flushed together:
+ * before sleeping or blocking on input, after BatchSize requests or when
+ * the oldest queued request has waited BatchLatency microseconds.
+ ****************************************************************************/
+const int DefaultBatchSize = 64;
+const long long DefaultBatchLatency = 1000;
+
+int       BatchSize = DefaultBatchSize;
+long long BatchLatency = DefaultBatchLatency;
+bool      FlushStats = false;
+
+/***************************************************************************** 
+ * Send the fake input through xcb instead of Xlib? The display is still
+ * opened with Xlib, which shares its connection, but the FakeInput requests
+ * are issued as unchecked xcb requests that never wait for a reply.
+ ****************************************************************************/
+bool UseXcb = false;
+
+struct Batch {
+  unsigned int    Queued;
+  struct timespec Oldest;
+  unsigned long   Flushes, Requests, Largest;
+  unsigned long   Histogram[16];	// flushes of 1, 2-3, 4-7, ... requests
+};
+
+/***************************************************************************** 
+ * Adaptive pacing: instead of waiting Delay between events, the display is
+ * pinged (a GetInputFocus round trip) every QueueDepth events and the gap
+ * between events is set so that about QueueDepth events are in flight
+ * during one round trip (Little's law), i.e. to the smoothed latency
+ * divided by QueueDepth. A loaded server answers later and gets the events
+ * slower, an idle one gets them as fast as it takes them. 0 for the fixed
+ * Delay.
+ ****************************************************************************/
+const long long MaxPaceGap = 100000;
+
+int QueueDepth = 0;
+
+struct Pacing {
+  long long       Gap;		// microseconds between two events
+  long long       Latency;	// smoothed round trip, microseconds
+  unsigned int    Sent;		// events since the last ping
+  unsigned long   Pings;
+  struct timespec PingTime;
+#ifdef HAVE_XCB
+  unsigned int    Cookie;	// sequence of the ping in flight, 0 for none
+#endif
+};
+
+/***************************************************************************** 
+ * Strings of at least PasteThreshold bytes are pasted instead of typed (0
+ * for never). To paste, we own the CLIPBOARD and PRIMARY selections and
+ * send the PasteChord; then the text is served for up to PasteTimeout
+ * seconds until a client has it.
+ ****************************************************************************/
+struct Chord {
+  const char * Name;
+  KeySym       Mod1, Mod2, Key;
+  unsigned int Button;
+};
+
+const Chord Chords[] = {
+  { "shift-insert", XK_Shift_L, NoSymbol, XK_Insert, 0 },
+  { "ctrl-v", XK_Control_L, NoSymbol, XK_v, 0 },
+  { "ctrl-shift-v", XK_Control_L, XK_Shift_L, XK_v, 0 },
+  { "button2", NoSymbol, NoSymbol, NoSymbol, 2 }
+};
+
+const int PasteTimeout = 5;
+
+size_t        PasteThreshold = 0;
+const Chord * PasteChord = &Chords[0];
+
+/***************************************************************************** 
+ * How long the WaitFor commands wait at most, in microseconds
+ ****************************************************************************/
+const long long DefaultWaitTimeout = 10000000;
+
+long long WaitTimeout = DefaultWaitTimeout;
+
+/***************************************************************************** 
+ * How often WaitForPixels and WaitForChange look at the screen, in
+ * microseconds. No event tells when pixels change, so they have to poll.
+ ****************************************************************************/
+const long long PixelInterval = 10000;
+
+/***************************************************************************** 
+ * What is traced (see trace.h) and where to, 0 for the standard error.
+ * The played commands are traced at TraceEvent.
+ ****************************************************************************/
+int    Trace = TraceWarn;
+char * TracePath = 0;
+
+/***************************************************************************** 
+ * The keysyms of the 8 bit character set of Strings, or 0 for UTF-8
+ ****************************************************************************/
+const KeySym * Charset = 0;
+
+/***************************************************************************** 
+ * The modifiers selecting the level of a character in a String
+ ****************************************************************************/
+const unsigned char LevelShift = 1;
+const unsigned char LevelThird = 2;
+
+/***************************************************************************** 
+ * A text macro is parsed by a thread of its own, which runs up to
+ * MacroLookahead commands ahead of the one being played, so reading and
+ * parsing never hold up the timing of the events. The commands are handed
+ * over with their text copied, as the reader reuses its buffer.
+ ****************************************************************************/
+const size_t MacroLookahead = 256;
+
+struct ParsedEvent {
+  MacroEvent  Ev;
+  bool        HasText;
+  std::string Text;
+};
+
+typedef Ring<ParsedEvent, MacroLookahead> EventRing;
+
+/***************************************************************************** 
+ * A remote display and what is kept for it: the keyboard mapping, fetched
+ * once at startup, the batch of queued requests and the timeline. All
+ * delays are kept on one absolute timeline, Deadline being when the next
+ * event is due, so sleeping late now and then does not add up over a long
+ * macro. Only one display echoes the played commands.
+ ****************************************************************************/
+struct Target {
+  Display *       Dpy;
+  int             Screen;
+  KeyMap          Keys;
+  Batch           Pending;
+  Pacing          Pace;
+  struct timespec Deadline;
+  struct timespec Done;		// when the server had seen the whole macro
+  int             Id;		// the source of its trace records
+  unsigned char   Held;		// modifiers held down by sendChar()
+  Selection       Sel;		// the text being pasted
+  RegionGrab      Region;		// for WaitForPixels and WaitForChange
+  std::deque<Target> * Group;	// all displays, when played in lockstep
+  std::vector<PathPoint> Path;	// the motions not played yet
+  std::vector<PathPoint> Samples;	// and what is played of them
+  long long       PathDelay;	// the Delays since the last point of Path
+  unsigned long   PathPoints, PathSent;
+#ifdef HAVE_XCB
+  xcb_connection_t * Conn;	// set when playing through xcb
+#endif
+
+  Target () : Dpy ( 0 ), Screen ( 0 ), Pending (), Pace (), Id ( 0 ), Held ( 0 ),
+				Group ( 0 ), PathDelay ( 0 ), PathPoints ( 0 ), PathSent ( 0 ) {
+	Pace.Gap = Delay * 1000LL;
+#ifdef HAVE_XCB
+	Conn = 0;
+#endif
+  }
+};
 
 using namespace std;
 
@@ -92,12 +331,55 @@ void usage (const int exitCode) {
 
   // print the usage
   cerr << PROG << " " << VERSION << endl;
-  cerr << "Usage: " << PROG << " [options] remote_display" << endl;
+  cerr << "Usage: " << PROG << " [options] remote_display..." << endl;
   cerr << "Options: " << endl;
   cerr << "  -d  DELAY   delay in milliseconds for events sent to remote display." << endl
 	   << "              Default: 10ms."
 	   << endl
 	   << "  -s  FACTOR  scalefactor for coordinates. Default: 1.0." << endl
+	   << "  --speed N   play the Delay commands N times faster. Default: 1.0." << endl
+	   << "  --max-gap T wait at most T (e.g. \"500ms\") for a Delay command." << endl
+	   << "  --motion-rate HZ" << endl
+	   << "              play the motions as paths resampled to HZ points per" << endl
+	   << "              second, or \"end\" for only where they end. Default:" << endl
+	   << "              every motion as recorded." << endl
+	   << "  --interpolate I" << endl
+	   << "              the points of resampled paths: none, linear or spline." << endl
+	   << "              Default: linear." << endl
+	   << "  --adaptive N" << endl
+	   << "              pace the events by the latency of the display, keeping" << endl
+	   << "              about N events in flight, instead of using '-d'." << endl
+	   << "  -b  N       flush at most N requests at once. Default: 64." << endl
+	   << "  -l  TIME    flush queued requests after TIME. Default: 1ms." << endl
+	   << "  --flush-stats" << endl
+	   << "              report how many requests went into each flush." << endl
+	   << "  --daemon SOCKET" << endl
+	   << "              keep the display open and play the macros submitted" << endl
+	   << "              on the Unix socket SOCKET." << endl
+	   << "  --submit SOCKET" << endl
+	   << "              hand the macro to the daemon on SOCKET and wait for it" << endl
+	   << "              to be played. No display is needed." << endl
+	   << "  --backend B send the events through B, \"xlib\" or \"xcb\"." << endl
+	   << "              Default: xlib." << endl
+	   << "  -c  CHARSET character set of Strings: utf-8, latin1 or latin2." << endl
+	   << "              Default: utf-8." << endl
+	   << "  --paste-threshold N" << endl
+	   << "              paste Strings of N bytes or more instead of typing them." << endl
+	   << "  --paste-keys CHORD" << endl
+	   << "              paste with CHORD: shift-insert, ctrl-v, ctrl-shift-v or" << endl
+	   << "              button2. Default: shift-insert." << endl
+	   << "  --wait-timeout T" << endl
+	   << "              give up the WaitFor commands after T. Default: 10s." << endl
+	   << "  --trace L   trace up to level L: off, warn, info, event (the played" << endl
+	   << "              commands) or debug. Default: warn." << endl
+	   << "  --trace-file FILE" << endl
+	   << "              write the trace to FILE instead of the standard error." << endl
+	   << "  --optimize  take the waste out of the macro before playing it, as" << endl
+	   << "              xmacroopt does." << endl
+	   << "  --lockstep  with several displays, send each command to all of them" << endl
+	   << "              before the next. Default: a thread per display." << endl
+	   << "  -f  FILE    read the macro from FILE instead of the standard input." << endl
+	   << "              Macros compiled by xmacroc are detected and mapped." << endl
 	   << "  -v          show version. " << endl
 	   << "  -h          this help. " << endl << endl;
 
@@ -180,10 +462,223 @@ void parseCommandLine (int argc, char * argv[]) {
 	  Index++;
 	}
 
-	// is this the last parameter?
-	else if ( Index == argc - 1 ) {
-	  // yep, we assume it's the display, store it
-	  Remote = argv [ Index ];
+	// is this '--speed'?
+	else if ( strcmp (argv[Index], "--speed" ) == 0 && Index + 1 < argc ) {
+	  // yep, and there seems to be a parameter too, interpret it as a
+	  // floating point number
+	  if ( sscanf ( argv[Index + 1], "%f", &Speed ) != 1 || Speed <= 0 ) {
+		cerr << "Invalid parameter for '--speed'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--max-gap'?
+	else if ( strcmp (argv[Index], "--max-gap" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a duration
+	  int32_t Sec, Usec;
+
+	  if ( ! parseDuration ( argv[Index + 1], Sec, Usec ) ) {
+		cerr << "Invalid parameter for '--max-gap'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  MaxGap = Sec * 1000000LL + Usec;
+	  Index++;
+	}
+
+	// is this '--motion-rate'?
+	else if ( strcmp (argv[Index], "--motion-rate" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a rate in Hz or "end"
+	  if ( strcmp ( argv[Index + 1], "end" ) == 0 ) MotionRate = 0;
+	  else if ( sscanf ( argv[Index + 1], "%d", &MotionRate ) != 1
+				|| MotionRate < 1 || MotionRate > MaxMotionRate ) {
+		cerr << "Invalid parameter for '--motion-rate'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--interpolate'?
+	else if ( strcmp (argv[Index], "--interpolate" ) == 0 && Index + 1 < argc ) {
+	  // yep, how the points between the recorded ones are found
+	  if ( strcmp ( argv[Index + 1], "none" ) == 0 ) Interpolate = InterpolateNone;
+	  else if ( strcmp ( argv[Index + 1], "linear" ) == 0 ) Interpolate = InterpolateLinear;
+	  else if ( strcmp ( argv[Index + 1], "spline" ) == 0 ) Interpolate = InterpolateSpline;
+	  else {
+		cerr << "Invalid parameter for '--interpolate'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--adaptive'?
+	else if ( strcmp (argv[Index], "--adaptive" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the number of events kept in flight
+	  if ( sscanf ( argv[Index + 1], "%d", &QueueDepth ) != 1 || QueueDepth < 1 ) {
+		cerr << "Invalid parameter for '--adaptive'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '-b'?
+	else if ( strcmp (argv[Index], "-b" ) == 0 && Index + 1 < argc ) {
+	  // yep, and there seems to be a parameter too, interpret it as a
+	  // number
+	  if ( sscanf ( argv[Index + 1], "%d", &BatchSize ) != 1 || BatchSize < 1 ) {
+		cerr << "Invalid parameter for '-b'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '-l'?
+	else if ( strcmp (argv[Index], "-l" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a duration
+	  int32_t Sec, Usec;
+
+	  if ( ! parseDuration ( argv[Index + 1], Sec, Usec ) ) {
+		cerr << "Invalid parameter for '-l'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  BatchLatency = Sec * 1000000LL + Usec;
+	  Index++;
+	}
+
+	// is this '--flush-stats'?
+	else if ( strcmp (argv[Index], "--flush-stats" ) == 0 ) {
+	  FlushStats = true;
+	}
+
+	// is this '--daemon' or '--submit'?
+	else if ( ( strcmp (argv[Index], "--daemon" ) == 0
+				|| strcmp (argv[Index], "--submit" ) == 0 ) && Index + 1 < argc ) {
+	  Daemon = argv[Index][2] == 'd';
+	  Socket = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '--backend'?
+	else if ( strcmp (argv[Index], "--backend" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the name of the backend
+	  if ( strcmp ( argv[Index + 1], "xcb" ) == 0 ) UseXcb = true;
+	  else if ( strcmp ( argv[Index + 1], "xlib" ) == 0 ) UseXcb = false;
+	  else {
+		cerr << "Invalid parameter for '--backend'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+#ifndef HAVE_XCB
+	  if ( UseXcb ) {
+		cerr << PROG << " was built without xcb, rebuild it with 'make XCB=1'." << endl;
+		exit ( EXIT_FAILURE );
+	  }
+#endif
+	  Index++;
+	}
+
+	// is this '-c'?
+	else if ( strcmp (argv[Index], "-c" ) == 0 && Index + 1 < argc ) {
+	  // yep, look the character set up by name
+	  size_t i = 0, n = sizeof (Charsets) / sizeof (Charsets[0]);
+
+	  while ( i < n && strcmp ( argv[Index + 1], Charsets[i].Name ) != 0 ) i++;
+	  if ( i < n ) Charset = Charsets[i].Table;
+	  else if ( strcmp ( argv[Index + 1], "utf-8" ) == 0 ) Charset = 0;
+	  else {
+		cerr << "Invalid parameter for '-c'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--paste-threshold'?
+	else if ( strcmp (argv[Index], "--paste-threshold" ) == 0 && Index + 1 < argc ) {
+	  // yep, and there seems to be a parameter too, interpret it as a
+	  // number
+	  if ( sscanf ( argv[Index + 1], "%zu", &PasteThreshold ) != 1 ) {
+		cerr << "Invalid parameter for '--paste-threshold'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--paste-keys'?
+	else if ( strcmp (argv[Index], "--paste-keys" ) == 0 && Index + 1 < argc ) {
+	  // yep, look the chord up by name
+	  PasteChord = 0;
+	  for ( size_t i = 0; i < sizeof (Chords) / sizeof (Chords[0]); i++ )
+		if ( strcmp ( argv[Index + 1], Chords[i].Name ) == 0 ) PasteChord = &Chords[i];
+
+	  if ( ! PasteChord ) {
+		cerr << "Invalid parameter for '--paste-keys'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--wait-timeout'?
+	else if ( strcmp (argv[Index], "--wait-timeout" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a duration
+	  int32_t Sec, Usec;
+
+	  if ( ! parseDuration ( argv[Index + 1], Sec, Usec ) ) {
+		cerr << "Invalid parameter for '--wait-timeout'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  WaitTimeout = Sec * 1000000LL + Usec;
+	  Index++;
+	}
+
+	// is this '--trace'?
+	else if ( strcmp (argv[Index], "--trace" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the level
+	  if ( ( Trace = traceLevelByName ( argv[Index + 1] ) ) < 0 ) {
+		cerr << "Invalid parameter for '--trace'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--trace-file'?
+	else if ( strcmp (argv[Index], "--trace-file" ) == 0 && Index + 1 < argc ) {
+	  // yep, write the trace there
+	  TracePath = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '--optimize'?
+	else if ( strcmp (argv[Index], "--optimize" ) == 0 ) {
+	  Optimize = true;
+	}
+
+	// is this '--lockstep'?
+	else if ( strcmp (argv[Index], "--lockstep" ) == 0 ) {
+	  Lockstep = true;
+	}
+
+	// is this '-f'?
+	else if ( strcmp (argv[Index], "-f" ) == 0 && Index + 1 < argc ) {
+	  // yep, read the macro from that file
+	  Input = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this one of the last parameters?
+	else if ( argv[Index][0] != '-' ) {
+	  // yep, we assume it's a display, store it
+	  Remotes.push_back ( argv [ Index ] );
 	}
 
 	else {
@@ -195,6 +690,14 @@ void parseCommandLine (int argc, char * argv[]) {
 	// next value
 	Index++;
   }
+
+  // no display given, use $DISPLAY
+  if ( Remotes.empty () ) Remotes.push_back ( 0 );
+
+  if ( Daemon && Remotes.size () > 1 ) {
+	cerr << "The daemon plays on a single display." << endl;
+	usage ( EXIT_FAILURE );
+  }
 }
 
 /****************************************************************************/
@@ -257,247 +760,1524 @@ int scale (const int Coordinate) {
 }
 
 /****************************************************************************/
-/*! Sends a \a character to the remote display \a RemoteDpy. The character is
-    converted to a \c KeySym based on a character table and then reconverted to
-	a \c KeyCode on the remote display. Seems to work quite ok, apart from
-	something weird with the Alt key.
+/*! Handles the events that have arrived from the remote display of \a T so
+    far, without blocking and without flushing: changes of the keyboard
+	mapping and requests for a selection we still serve. Other events are
+	dropped, the WaitFor commands look for theirs while they wait.
+*/
+/****************************************************************************/
+void processEvents (Target & T) {
+
+  XEvent Event;
+
+  while ( XEventsQueued ( T.Dpy, QueuedAfterReading ) ) {
+	XNextEvent ( T.Dpy, &Event );
+	if ( ! handleKeyMapEvent ( T.Dpy, T.Keys, Event ) )
+	  handleSelectionEvent ( T.Dpy, T.Sel, Event );
+  }
+}
 
-    \arg Display * RemoteDpy - used display.
-	\arg char c - character to send.
+/****************************************************************************/
+/*! Sends the queued requests to the remote display and counts them. The
+    events that came in meanwhile are handled first, once per batch rather
+	than per command; nothing the batch causes can be among them yet.
 */
 /****************************************************************************/
-void sendChar(Display *RemoteDpy, char c)
-{
-	KeySym ks, sks, *kss, ksl, ksu;
-	KeyCode kc, skc;
-	int syms;
-#ifdef DEBUG
-	int i;
-#endif
+void flushBatch (Target & T) {
 
-	sks=XK_Shift_L;
-
-	ks=XStringToKeysym(chartbl[0][(unsigned char)c]);
-	if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	{
-  		cerr << "No keycode on remote display found for char: " << c << endl;
-	  	return;
-	}
-	if ( ( skc = XKeysymToKeycode ( RemoteDpy, sks ) ) == 0 )
-	{
-  		cerr << "No keycode on remote display found for XK_Shift_L!" << endl;
-	  	return;
-	}
-
-	kss=XGetKeyboardMapping(RemoteDpy, kc, 1, &syms);
-	if (!kss)
-	{
-  		cerr << "XGetKeyboardMapping failed on the remote display (keycode: " << kc << ")" << endl;
-	  	return;
-	}
-	for (; syms && (!kss[syms-1]); syms--);
-	if (!syms)
-	{
-  		cerr << "XGetKeyboardMapping failed on the remote display (no syms) (keycode: " << kc << ")" << endl;
-		XFree(kss);
-	  	return;
-	}
-	XConvertCase(ks,&ksl,&ksu);
-#ifdef DEBUG
-	cout << "kss: ";
-	for (i=0; i<syms; i++) cout << kss[i] << " ";
-	cout << "(" << ks << " l: " << ksl << "  h: " << ksu << ")" << endl;
+  Batch & Pending = T.Pending;
+  unsigned int Bucket = 0;
+
+  if ( ! Pending.Queued ) return;
+
+  processEvents ( T );
+
+#ifdef HAVE_XCB
+  if ( T.Conn ) xcb_flush ( T.Conn );
+  else
 #endif
-	if (ks==kss[0] && (ks==ksl && ks==ksu)) sks=NoSymbol;
-	if (ks==ksl && ks!=ksu) sks=NoSymbol;
-	if (sks!=NoSymbol) XTestFakeKeyEvent ( RemoteDpy, skc, True, Delay );
-	XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	XFlush ( RemoteDpy );
-	XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	if (sks!=NoSymbol) XTestFakeKeyEvent ( RemoteDpy, skc, False, Delay );
-	XFlush ( RemoteDpy );
-	XFree(kss);
+  XFlush ( T.Dpy );
+
+  while ( Bucket < 15 && ( Pending.Queued >> ( Bucket + 1 ) ) ) Bucket++;
+  Pending.Histogram[Bucket]++;
+  Pending.Flushes++;
+  Pending.Requests += Pending.Queued;
+  if ( Pending.Queued > Pending.Largest ) Pending.Largest = Pending.Queued;
+  Pending.Queued = 0;
+}
+
+/****************************************************************************/
+/*! Accounts for a request put in the output buffer of the remote display and
+    flushes the batch if it is full or has waited long enough.
+*/
+/****************************************************************************/
+void queueRequest (Target & T) {
+
+  Batch & Pending = T.Pending;
+  struct timespec Now;
+
+  if ( ! Pending.Queued++ ) {
+	clock_gettime ( CLOCK_MONOTONIC, &Pending.Oldest );
+	return;
+  }
+
+  if ( Pending.Queued >= (unsigned int) BatchSize ) {
+	flushBatch ( T );
+	return;
+  }
+
+  clock_gettime ( CLOCK_MONOTONIC, &Now );
+  if ( ( Now.tv_sec - Pending.Oldest.tv_sec ) * 1000000LL
+	   + ( Now.tv_nsec - Pending.Oldest.tv_nsec ) / 1000 >= BatchLatency )
+	flushBatch ( T );
 }
 
 /****************************************************************************/
-/*! Main event-loop of the application. Loops until a key with the keycode
-    \a QuitKey is pressed. Sends all mouse- and key-events to the remote
-	display.
+/*! Prints how many requests went into the flushes of the batch of \a T.
+*/
+/****************************************************************************/
+void reportBatches (const Target & T) {
+
+  const Batch & Pending = T.Pending;
+  unsigned int i;
+
+  if ( Remotes.size () > 1 ) cerr << DisplayString ( T.Dpy ) << ": ";
+  cerr << "Flushed " << Pending.Requests << " requests in " << Pending.Flushes
+	   << " flushes, at most " << Pending.Largest << " at once." << endl;
+  if ( T.Keys.Remaps )
+	cerr << "Bound " << T.Keys.Remaps << " keysyms to spare keycodes in "
+		 << T.Keys.RemapRequests << " requests." << endl;
+  if ( MotionRate >= 0 )
+	cerr << "Resampled " << T.PathPoints << " motions to " << T.PathSent << "." << endl;
+  if ( QueueDepth )
+	cerr << "Paced by " << T.Pace.Pings << " pings, latency " << T.Pace.Latency
+		 << " us, " << T.Pace.Gap << " us between events." << endl;
+  for ( i = 0; i < 16; i++ ) {
+	if ( ! Pending.Histogram[i] ) continue;
+	cerr << "  " << setw (5) << ( 1u << i ) << "-" << setw (5) << ( 2u << i ) - 1
+		 << " requests: " << Pending.Histogram[i] << " flushes" << endl;
+  }
+}
 
-    \arg Display * RemoteDpy - used display.
-	\arg int RemoteScreen - the used screen.
+/****************************************************************************/
+/*! Starts the timeline of the macro on \a T at the current time.
 */
 /****************************************************************************/
-void eventLoop (Display * RemoteDpy, int RemoteScreen) {
+void startTimeline (Target & T) {
 
-  char ev[200], str[1024];
-  int x, y;
-  unsigned int b;
-  KeySym ks;
-  KeyCode kc;
-  
-  while ( !cin.eof() ) {
-	cin >> ev;
-	if (ev[0]=='#')
-	{
-	  cout << "Comment: " << ev << endl;
-	  continue;
-	}
-	if (!strcasecmp("Delay",ev))
-	{
-	  cin >> b;
-	  cout << "Delay: " << b << endl;
-	  sleep ( b );
-	}
-	else if (!strcasecmp("ButtonPress",ev))
-	{
-	  cin >> b;
-	  cout << "ButtonPress: " << b << endl;
-	  XTestFakeButtonEvent ( RemoteDpy, b, True, Delay );
-	}
-	else if (!strcasecmp("ButtonRelease",ev))
-	{
-	  cin >> b;
-	  cout << "ButtonRelease: " << b << endl;
-	  XTestFakeButtonEvent ( RemoteDpy, b, False, Delay );
-	}
-	else if (!strcasecmp("MotionNotify",ev))
-	{
-	  cin >> x >> y;
-	  cout << "MotionNotify: " << x << " " << y << endl;
-	  XTestFakeMotionEvent ( RemoteDpy, RemoteScreen , scale ( x ), scale ( y ), Delay ); 
-	}
-	else if (!strcasecmp("KeyCodePress",ev))
-	{
-	  cin >> kc;
-	  cout << "KeyPress: " << kc << endl;
-	  XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	}
-	else if (!strcasecmp("KeyCodeRelease",ev))
-	{
-	  cin >> kc;
-	  cout << "KeyRelease: " << kc << endl;
-  	  XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	}
-	else if (!strcasecmp("KeySym",ev))
-	{
-	  cin >> ks;
-	  cout << "KeySym: " << ks << endl;
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for keysym: " << ks << endl;
-	  	continue;
-	  }
-	  XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	  XFlush ( RemoteDpy );
-	  XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	}
-	else if (!strcasecmp("KeySymPress",ev))
-	{
-	  cin >> ks;
-	  cout << "KeySymPress: " << ks << endl;
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for keysym: " << ks << endl;
-	  	continue;
-	  }
-	  XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	}
-	else if (!strcasecmp("KeySymRelease",ev))
-	{
-	  cin >> ks;
-	  cout << "KeySymRelease: " << ks << endl;
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for keysym: " << ks << endl;
-	  	continue;
-	  }
-  	  XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	}
-	else if (!strcasecmp("KeyStr",ev))
-	{
-	  cin >> ev;
-	  cout << "KeyStr: " << ev << endl;
-	  ks=XStringToKeysym(ev);
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for '" << ev << "': " << ks << endl;
-	  	continue;
-	  }
-	  XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	  XFlush ( RemoteDpy );
-	  XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	}
-	else if (!strcasecmp("KeyStrPress",ev))
-	{
-	  cin >> ev;
-	  cout << "KeyStrPress: " << ev << endl;
-	  ks=XStringToKeysym(ev);
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for '" << ev << "': " << ks << endl;
-	  	continue;
-	  }
-	  XTestFakeKeyEvent ( RemoteDpy, kc, True, Delay );
-	}
-	else if (!strcasecmp("KeyStrRelease",ev))
-	{
-	  cin >> ev;
-	  cout << "KeyStrRelease: " << ev << endl;
-	  ks=XStringToKeysym(ev);
-	  if ( ( kc = XKeysymToKeycode ( RemoteDpy, ks ) ) == 0 )
-	  {
-	  	cerr << "No keycode on remote display found for '" << ev << "': " << ks << endl;
-	  	continue;
-	  }
-  	  XTestFakeKeyEvent ( RemoteDpy, kc, False, Delay );
-	}
-	else if (!strcasecmp("String",ev))
-	{
-	  cin.ignore().get(str,1024);
-	  cout << "String: " << str << endl;
-	  b=0;
-	  while(str[b]) sendChar(RemoteDpy, str[b++]);
-	}
-	else if (ev[0]!=0) cout << "Unknown tag: " << ev << endl;
+  clock_gettime ( CLOCK_MONOTONIC, &T.Deadline );
+}
+
+/****************************************************************************/
+/*! Returns the microseconds from \a From to \a To.
+*/
+/****************************************************************************/
+long long elapsed (const struct timespec & From, const struct timespec & To) {
 
-	// sync the remote server
-	XFlush ( RemoteDpy );
-  } 
+  return ( To.tv_sec - From.tv_sec ) * 1000000LL + ( To.tv_nsec - From.tv_nsec ) / 1000;
 }
 
+/****************************************************************************/
+/*! Moves the timeline of \a T to the current time if it is behind, after
+    waiting for something else than the clock. The time spent waiting is
+	not made up for by playing the following events faster.
+*/
+/****************************************************************************/
+void catchUp (Target & T) {
+
+  struct timespec Now;
+
+  clock_gettime ( CLOCK_MONOTONIC, &Now );
+  if ( elapsed ( T.Deadline, Now ) > 0 ) T.Deadline = Now;
+}
 
 /****************************************************************************/
-/*! Main function of the application. It expects no commandline arguments.
+/*! Returns a poll entry waiting for \a Fd to become readable.
+*/
+/****************************************************************************/
+struct pollfd pollIn (int Fd) {
 
-    \arg int argc - number of commandline arguments.
-	\arg char * argv[] - vector of the commandline argument strings.
+  struct pollfd p;
+
+  p.fd = Fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  return p;
+}
+
+/****************************************************************************/
+/*! Moves the deadline \a Usec microseconds further and sleeps until it is
+    reached. What is queued for the display is flushed first so it arrives
+	on time. If we are already late we don't sleep at all and catch up.
+
+    \arg Target & T - used display.
+	\arg long long Usec - the delay in microseconds.
 */
 /****************************************************************************/
-int main (int argc, char * argv[]) {
+void waitFor (Target & T, long long Usec) {
 
-  // parse commandline arguments
-  parseCommandLine ( argc, argv );
-  
-  // open the remote display or abort
-  Display * RemoteDpy = remoteDisplay ( Remote );
+  struct timespec & Deadline = T.Deadline;
 
-  // get the screens too
-  int RemoteScreen = DefaultScreen ( RemoteDpy );
-  
-  XTestDiscard ( RemoteDpy );
+  if ( Usec <= 0 ) return;
 
-  // start the main event loop
-  eventLoop ( RemoteDpy, RemoteScreen );
+  Deadline.tv_sec  += Usec / 1000000;
+  Deadline.tv_nsec += ( Usec % 1000000 ) * 1000;
+  if ( Deadline.tv_nsec >= 1000000000 ) {
+	Deadline.tv_sec++;
+	Deadline.tv_nsec -= 1000000000;
+  }
 
-  // discard and even flush all events on the remote display
-  XTestDiscard ( RemoteDpy );
-  XFlush ( RemoteDpy ); 
+  // in lockstep the other displays must not wait for our sleep
+  if ( T.Group )
+	for ( size_t i = 0; i < T.Group->size (); i++ ) flushBatch ( (*T.Group)[i] );
+  else flushBatch ( T );
+  while ( clock_nanosleep ( CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, 0 ) == EINTR );
+}
 
-  // we're done with the display
-  XCloseDisplay ( RemoteDpy );
+/****************************************************************************/
+/*! Takes the round trip \a Usec of a ping into the latency of \a T and
+    moves the gap between events towards the latency spread over QueueDepth
+	events.
+*/
+/****************************************************************************/
+void measureLatency (Target & T, long long Usec) {
+
+  Pacing & Pace = T.Pace;
+
+  Pace.Pings++;
+  Pace.Latency = Pace.Pings == 1 ? Usec : ( Pace.Latency * 7 + Usec ) / 8;
+  Pace.Gap = ( Pace.Gap * 3 + Pace.Latency / QueueDepth ) / 4;
+  if ( Pace.Gap > MaxPaceGap ) Pace.Gap = MaxPaceGap;
+}
+
+/****************************************************************************/
+/*! Counts an event sent to \a T when pacing adaptively and pings the display
+    every QueueDepth events. Through xcb the ping is answered while we go on
+	and only waited for if the next ping is due before, through Xlib it is
+	an XSync, which also waits for the events before it.
+*/
+/****************************************************************************/
+void pace (Target & T) {
+
+  Pacing & Pace = T.Pace;
+  struct timespec Now;
+
+  if ( ! QueueDepth ) return;
+
+#ifdef HAVE_XCB
+  if ( T.Conn ) {
+	xcb_get_input_focus_cookie_t Ping;
+	xcb_get_input_focus_reply_t * Reply = 0;
+
+	// look whether the ping in flight was answered, without waiting
+	if ( Pace.Cookie && xcb_poll_for_reply ( T.Conn, Pace.Cookie, (void **) &Reply, 0 ) ) {
+	  clock_gettime ( CLOCK_MONOTONIC, &Now );
+	  measureLatency ( T, elapsed ( Pace.PingTime, Now ) );
+	  free ( Reply );
+	  Pace.Cookie = 0;
+	}
+
+	if ( ++Pace.Sent < (unsigned int) QueueDepth ) return;
+
+	// more than QueueDepth events are in flight, wait for the server
+	if ( Pace.Cookie ) {
+	  Ping.sequence = Pace.Cookie;
+	  free ( xcb_get_input_focus_reply ( T.Conn, Ping, 0 ) );
+	  clock_gettime ( CLOCK_MONOTONIC, &Now );
+	  measureLatency ( T, elapsed ( Pace.PingTime, Now ) );
+	}
+
+	Ping = xcb_get_input_focus ( T.Conn );
+	Pace.Cookie = Ping.sequence;
+	Pace.Sent = 0;
+	clock_gettime ( CLOCK_MONOTONIC, &Pace.PingTime );
+	flushBatch ( T );
+	return;
+  }
+#endif
+
+  if ( ++Pace.Sent < (unsigned int) QueueDepth ) return;
+
+  flushBatch ( T );
+  clock_gettime ( CLOCK_MONOTONIC, &Pace.PingTime );
+  XSync ( T.Dpy, False );
+  clock_gettime ( CLOCK_MONOTONIC, &Now );
+  measureLatency ( T, elapsed ( Pace.PingTime, Now ) );
+  Pace.Sent = 0;
+}
+
+/****************************************************************************/
+/*! Sends a key event for keycode \a kc to the remote display, \a Delay
+    milliseconds (or the adaptive gap) after the previous event.
+*/
+/****************************************************************************/
+void fakeKey (Target & T, KeyCode kc, Bool Press) {
+
+  waitFor ( T, T.Pace.Gap );
+#ifdef HAVE_XCB
+  if ( T.Conn )
+	xcb_test_fake_input ( T.Conn, Press ? XCB_KEY_PRESS : XCB_KEY_RELEASE, kc,
+						  XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0 );
+  else
+#endif
+  XTestFakeKeyEvent ( T.Dpy, kc, Press, CurrentTime );
+  queueRequest ( T );
+  pace ( T );
+}
+
+/****************************************************************************/
+/*! Sends a button event for \a Button to the remote display, \a Delay
+    milliseconds (or the adaptive gap) after the previous event.
+*/
+/****************************************************************************/
+void fakeButton (Target & T, unsigned int Button, Bool Press) {
+
+  waitFor ( T, T.Pace.Gap );
+#ifdef HAVE_XCB
+  if ( T.Conn )
+	xcb_test_fake_input ( T.Conn, Press ? XCB_BUTTON_PRESS : XCB_BUTTON_RELEASE,
+						  Button, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0 );
+  else
+#endif
+  XTestFakeButtonEvent ( T.Dpy, Button, Press, CurrentTime );
+  queueRequest ( T );
+  pace ( T );
+}
+
+/****************************************************************************/
+/*! Moves the pointer of the remote display to \a x, \a y now.
+*/
+/****************************************************************************/
+void sendMotion (Target & T, int x, int y) {
+
+#ifdef HAVE_XCB
+  if ( T.Conn )
+	// detail 0 is an absolute motion on the root window of the screen
+	xcb_test_fake_input ( T.Conn, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+						  RootWindow ( T.Dpy, T.Screen ), x, y, 0 );
+  else
+#endif
+  XTestFakeMotionEvent ( T.Dpy, T.Screen, x, y, CurrentTime );
+  queueRequest ( T );
+  pace ( T );
+}
+
+/****************************************************************************/
+/*! Moves the pointer of the remote display to \a x, \a y, \a Delay
+    milliseconds (or the adaptive gap) after the previous event.
+*/
+/****************************************************************************/
+void fakeMotion (Target & T, int x, int y) {
+
+  waitFor ( T, T.Pace.Gap );
+  sendMotion ( T, x, y );
+}
+
+/****************************************************************************/
+/*! Presses and releases the modifiers of \a T so that exactly the levels in
+    \a Need (LevelShift, LevelThird) are held. Modifiers already in the right
+	state are left alone, so a run of characters on the same level costs no
+	modifier events at all.
+*/
+/****************************************************************************/
+void holdLevels (Target & T, unsigned char Need) {
+
+  if ( ( T.Held ^ Need ) & LevelShift )
+	fakeKey ( T, T.Keys.ShiftCode, ( Need & LevelShift ) != 0 );
+  if ( ( T.Held ^ Need ) & LevelThird )
+	fakeKey ( T, T.Keys.Level3Code, ( Need & LevelThird ) != 0 );
+
+  T.Held = Need;
+}
+
+/****************************************************************************/
+/*! Sends the keysym \a ks of a character to the remote display of \a T.
+    The keysym is converted to a \c KeyCode on the remote display, and the
+	modifiers for the level it is found on are held while the key is
+	pressed. They are not released afterwards: that is left to the next
+	character needing another level, or to sendString() when it is done.
+
+    \arg Target & T - used display.
+	\arg KeySym ks - keysym of the character to send.
+*/
+/****************************************************************************/
+void sendChar (Target & T, KeySym ks) {
+
+  const KeyMapEntry * e = lookupKeySym ( T.Keys, ks );
+  unsigned char Need;
+
+  // bindKeySyms() has bound what is only in another group to a spare
+  if ( ! e || e->Group ) {
+	trace ( TraceWarn, T.Id, "No keycode on remote display for keysym", TraceOneArg, ks );
+	return;
+  }
+
+  // level 2 is Shift, level 3 AltGr and level 4 both of them
+  Need = ( e->Level & 1 ? LevelShift : 0 ) | ( e->Level & 2 ? LevelThird : 0 );
+  if ( ( Need & LevelShift ) && ! T.Keys.ShiftCode ) {
+	trace ( TraceWarn, T.Id, "No keycode on remote display for Shift_L" );
+	return;
+  }
+  if ( ( Need & LevelThird ) && ! T.Keys.Level3Code ) {
+	trace ( TraceWarn, T.Id, "No keycode on remote display for ISO_Level3_Shift" );
+	return;
+  }
+
+  holdLevels ( T, Need );
+  fakeKey ( T, e->Code, True );
+  fakeKey ( T, e->Code, False );
+}
+
+/****************************************************************************/
+/*! Types the text \a Text of \a Len bytes on the remote display of \a T.
+    It is UTF-8, or in the 8 bit character set chosen with '-c'.
+	Characters missing from the keyboard mapping are bound to spare
+	keycodes first, as many at once as there are spares. Shift and AltGr
+	are held across runs of characters needing them.
+
+    \arg Target & T - used display.
+	\arg const char * Text - the text, it ends at a NUL byte too.
+	\arg size_t Len - length of the text.
+*/
+/****************************************************************************/
+void sendString (Target & T, const char * Text, size_t Len) {
+
+  const unsigned char * p = (const unsigned char *) Text, * End = p + Len;
+  vector<KeySym> Syms;
+  size_t Done, Ready;
+
+  while ( p < End && *p ) {
+	if ( Charset ) Syms.push_back ( Charset[*p++] );
+	else Syms.push_back ( charToKeysym ( T.Keys, decodeUtf8 ( p, End ) ) );
+  }
+
+  for ( Done = 0; Done < Syms.size (); Done = Ready ) {
+	Ready = Done + bindKeySyms ( T.Dpy, T.Keys, &Syms[Done], Syms.size () - Done );
+	for ( ; Done < Ready; Done++ ) {
+	  if ( Syms[Done] == NoSymbol ) continue;
+	  sendChar ( T, Syms[Done] );
+	}
+  }
+
+  // nothing stays held after the string
+  holdLevels ( T, 0 );
+}
+
+/****************************************************************************/
+/*! Presses and releases the key (or button) of \a Chord with its modifiers.
+*/
+/****************************************************************************/
+void sendChord (Target & T, const Chord & c) {
+
+  KeyCode Mod1 = keysymToKeycode ( T.Keys, c.Mod1 );
+  KeyCode Mod2 = keysymToKeycode ( T.Keys, c.Mod2 );
+  KeyCode Key  = keysymToKeycode ( T.Keys, c.Key );
+
+  if ( c.Button ) {
+	fakeButton ( T, c.Button, True );
+	fakeButton ( T, c.Button, False );
+	return;
+  }
+
+  if ( ! Key || ( c.Mod1 != NoSymbol && ! Mod1 ) || ( c.Mod2 != NoSymbol && ! Mod2 ) ) {
+	traceText ( TraceWarn, T.Id, "No keycodes on remote display for", c.Name, strlen ( c.Name ) );
+	return;
+  }
+
+  if ( Mod1 ) fakeKey ( T, Mod1, True );
+  if ( Mod2 ) fakeKey ( T, Mod2, True );
+  fakeKey ( T, Key, True );
+  fakeKey ( T, Key, False );
+  if ( Mod2 ) fakeKey ( T, Mod2, False );
+  if ( Mod1 ) fakeKey ( T, Mod1, False );
+}
+
+/****************************************************************************/
+/*! Pastes the UTF-8 text \a Text of \a Len bytes on the remote display of
+    \a T: it becomes the CLIPBOARD and PRIMARY selection, the paste chord is
+	sent and the text is served until a client has all of it, however long
+	it is. If the selections can't be owned the text is typed instead.
+
+    \arg Target & T - used display.
+	\arg const char * Text - the text, it ends at a NUL byte too.
+	\arg size_t Len - length of the text.
+*/
+/****************************************************************************/
+void pasteText (Target & T, const char * Text, size_t Len) {
+
+  struct timespec Now, Until;
+  struct pollfd p = pollIn ( ConnectionNumber ( T.Dpy ) );
+  long long Left;
+  XEvent Event;
+  bool Done = false;
+
+  Len = strnlen ( Text, Len );
+  if ( ! ownSelection ( T.Dpy, T.Sel, Text, Len ) ) {
+	trace ( TraceWarn, T.Id, "Could not own the selections, typing the text instead" );
+	sendString ( T, Text, Len );
+	return;
+  }
+
+  sendChord ( T, *PasteChord );
+  flushBatch ( T );
+
+  clock_gettime ( CLOCK_MONOTONIC, &Until );
+  Until.tv_sec += PasteTimeout;
+
+  while ( ! Done ) {
+	if ( ! XPending ( T.Dpy ) ) {
+	  clock_gettime ( CLOCK_MONOTONIC, &Now );
+	  if ( ( Left = elapsed ( Now, Until ) ) <= 0 ) break;
+	  poll ( &p, 1, ( Left + 999 ) / 1000 );
+	  continue;
+	}
+
+	XNextEvent ( T.Dpy, &Event );
+	if ( ! handleKeyMapEvent ( T.Dpy, T.Keys, Event ) )
+	  Done = handleSelectionEvent ( T.Dpy, T.Sel, Event );
+  }
+
+  if ( ! Done ) trace ( TraceWarn, T.Id, "Nobody took the pasted text, s", TraceOneArg, PasteTimeout );
+
+  disownSelection ( T.Dpy, T.Sel );
+  catchUp ( T );
+}
+
+/****************************************************************************/
+/*! Waits until the remote display of \a T is ready for the next command:
+    for WaitForWindow until a window matching \a Pattern is shown, for
+	WaitForMap until the next top level window matching \a Pattern is
+	mapped, for WaitForFocus until a window matching \a Pattern is active
+	and for WaitForIdle until no window was created, changed or had its
+	properties changed for \a Quiet microseconds. Instead of sleeping a
+	fixed time we watch the structure and property events of the root
+	window. Gives up after WaitTimeout.
+
+    \arg Target & T - used display.
+	\arg int Op - the WaitFor command.
+	\arg const string & Pattern - shell pattern for the title or class.
+	\arg long long Quiet - for WaitForIdle, the quiet time in microseconds.
+*/
+/****************************************************************************/
+void waitForWindow (Target & T, int Op, const string & Pattern, long long Quiet) {
+
+  Window Root = RootWindow ( T.Dpy, T.Screen ), W;
+  struct timespec Start, Now, Activity;
+  struct pollfd p = pollIn ( ConnectionNumber ( T.Dpy ) );
+  long long Left;
+  XEvent Event;
+  bool Ready = false;
+
+  flushBatch ( T );
+
+  // watch first, then look, so that nothing happens unseen in between
+  XSelectInput ( T.Dpy, Root, SubstructureNotifyMask | PropertyChangeMask );
+  clock_gettime ( CLOCK_MONOTONIC, &Start );
+  Activity = Start;
+
+  while ( true ) {
+	clock_gettime ( CLOCK_MONOTONIC, &Now );
+
+	if ( Op == OpWaitForWindow )
+	  Ready = findWindow ( T.Dpy, Root, Pattern.c_str () ) != None;
+	else if ( Op == OpWaitForFocus ) {
+	  W = activeWindow ( T.Dpy, Root );
+	  Ready = W != None && windowMatches ( T.Dpy, W, Pattern.c_str () );
+	}
+	else if ( Op == OpWaitForIdle ) Ready = elapsed ( Activity, Now ) >= Quiet;
+	if ( Ready ) break;
+
+	Left = WaitTimeout - elapsed ( Start, Now );
+	if ( Left <= 0 ) {
+	  traceText ( TraceWarn, T.Id, macroOpName ( Op ), "gave up", 7 );
+	  break;
+	}
+
+	// titles and the focus may change without any event on the root
+	// window, so they are looked at again after a while anyway
+	if ( Op == OpWaitForIdle ) Left = min ( Left, Quiet - elapsed ( Activity, Now ) );
+	else if ( Op != OpWaitForMap ) Left = min ( Left, 100000LL );
+
+	if ( ! XPending ( T.Dpy ) ) poll ( &p, 1, ( Left + 999 ) / 1000 );
+
+	while ( XPending ( T.Dpy ) ) {
+	  XNextEvent ( T.Dpy, &Event );
+	  if ( handleKeyMapEvent ( T.Dpy, T.Keys, Event ) ) continue;
+
+	  clock_gettime ( CLOCK_MONOTONIC, &Activity );
+	  if ( Op == OpWaitForMap && Event.type == MapNotify && Event.xmap.event == Root
+		   && ! Event.xmap.override_redirect
+		   && windowMatches ( T.Dpy, Event.xmap.window, Pattern.c_str () ) )
+		Ready = true;
+	}
+	if ( Ready ) break;
+  }
+
+  XSelectInput ( T.Dpy, Root, NoEventMask );
+  catchUp ( T );
+}
+
+/****************************************************************************/
+/*! Waits until the region of \a Want.W x \a Want.H pixels at \a x, \a y on
+    the remote display of \a T has the hash \a Want.Hash (WaitForPixels) or
+	differs from what it was when the command began (WaitForChange). The
+	region is grabbed every PixelInterval. Gives up after WaitTimeout.
+
+    \arg Target & T - used display.
+	\arg int Op - the WaitFor command.
+	\arg int x, y - top left corner of the region.
+	\arg const MacroRegion & Want - size and expected hash of the region.
+*/
+/****************************************************************************/
+void waitForPixels (Target & T, int Op, int x, int y, const MacroRegion & Want) {
+
+  struct timespec Start, Now, Pause = { 0, PixelInterval * 1000 };
+  uint64_t Hash, Before = 0;
+  char Last[TraceTextSize];
+  bool Ready = false;
+
+  flushBatch ( T );
+
+  if ( ( T.Region.W != Want.W || T.Region.H != Want.H )
+	   && ! openGrab ( T.Dpy, T.Screen, Want.W, Want.H, T.Region ) ) {
+	traceText ( TraceWarn, T.Id, macroOpName ( Op ), "invalid region size", 19 );
+	return;
+  }
+  if ( ! grabRegion ( T.Dpy, T.Screen, x, y, T.Region ) ) {
+	traceText ( TraceWarn, T.Id, macroOpName ( Op ), "region not on the screen", 24 );
+	return;
+  }
+  clock_gettime ( CLOCK_MONOTONIC, &Start );
+
+  Hash = hashRegion ( T.Region.Img );
+  if ( Op == OpWaitForChange ) Before = Hash;
+
+  while ( true ) {
+	Ready = Op == OpWaitForPixels ? Hash == Want.Hash : Hash != Before;
+	if ( Ready ) break;
+
+	clock_gettime ( CLOCK_MONOTONIC, &Now );
+	if ( elapsed ( Start, Now ) >= WaitTimeout ) {
+	  // what the region looks like instead, to fix the macro with
+	  if ( Op == OpWaitForPixels )
+		snprintf ( Last, sizeof (Last), "gave up at %016llx", (unsigned long long) Hash );
+	  else strcpy ( Last, "gave up" );
+	  traceText ( TraceWarn, T.Id, macroOpName ( Op ), Last, strlen ( Last ) );
+	  break;
+	}
+
+	nanosleep ( &Pause, 0 );
+	processEvents ( T );
+	if ( ! grabRegion ( T.Dpy, T.Screen, x, y, T.Region ) ) break;
+	Hash = hashRegion ( T.Region.Img );
+  }
+
+  catchUp ( T );
+}
+
+/****************************************************************************/
+/*! Returns how long the Delay command \a ev waits, in microseconds, at the
+    replay speed and at most MaxGap.
+*/
+/****************************************************************************/
+long long delayUsec (const MacroEvent & ev) {
+
+  long long Usec = (long long)( ( ev.A * 1000000LL + ev.B ) / Speed );
+
+  if ( MaxGap >= 0 && Usec > MaxGap ) Usec = MaxGap;
+  return Usec;
+}
+
+/****************************************************************************/
+/*! Returns the coordinate at \a u (0 to 1) between \a c1 and \a c2, the
+    recorded ones before and after being \a c0 and \a c3.
+*/
+/****************************************************************************/
+int interpolate (int c0, int c1, int c2, int c3, double u) {
+
+  double c;
+
+  switch ( Interpolate ) {
+	case InterpolateNone:
+	  return c1;
+
+	case InterpolateSpline:
+	  c = 0.5 * ( 2.0 * c1 + ( c2 - c0 ) * u + ( 2.0 * c0 - 5.0 * c1 + 4.0 * c2 - c3 ) * u * u
+				  + ( 3.0 * ( c1 - c2 ) + c3 - c0 ) * u * u * u );
+	  break;
+
+	default:
+	  c = c1 + ( c2 - c1 ) * u;
+  }
+
+  return (int) floor ( c + 0.5 );
+}
+
+/****************************************************************************/
+/*! Resamples the path of \a T into its Samples: the first and the last
+    point and one every 1 / MotionRate seconds in between. Samples not
+	moving the pointer after scaling are left out, the next one waits for
+	them.
+*/
+/****************************************************************************/
+void resamplePath (Target & T) {
+
+  const vector<PathPoint> & P = T.Path;
+  vector<PathPoint> & Out = T.Samples;
+  PathPoint s;
+  long long Period, At;
+  size_t i = 0, n = P.size ();
+  double u;
+
+  Out.clear ();
+  Out.push_back ( P[0] );
+
+  if ( MotionRate > 0 ) {
+	Period = 1000000 / MotionRate;
+	for ( At = P[0].Time + Period; At < P[n - 1].Time; At += Period ) {
+	  // the recorded points i and i + 1 are before and after At
+	  while ( P[i + 1].Time < At ) i++;
+	  u = (double)( At - P[i].Time ) / ( P[i + 1].Time - P[i].Time );
+	  s.x = interpolate ( P[i ? i - 1 : 0].x, P[i].x, P[i + 1].x, P[i + 2 < n ? i + 2 : i + 1].x, u );
+	  s.y = interpolate ( P[i ? i - 1 : 0].y, P[i].y, P[i + 1].y, P[i + 2 < n ? i + 2 : i + 1].y, u );
+	  s.Time = At;
+	  if ( scale ( s.x ) != scale ( Out.back ().x ) || scale ( s.y ) != scale ( Out.back ().y ) )
+		Out.push_back ( s );
+	}
+  }
+
+  if ( n > 1 ) Out.push_back ( P[n - 1] );
+}
+
+/****************************************************************************/
+/*! Plays the path of motions collected for \a T, resampled, and the Delays
+    after it. In lockstep the path is played on all displays at once, each
+	sample going to every display before the next one; they all collected
+	the same path and the timing of \a T is used.
+*/
+/****************************************************************************/
+void playPath (Target & T) {
+
+  size_t i, k, Count = T.Group ? T.Group->size () : 1;
+  long long Last = 0;
+
+  if ( T.Path.empty () ) return;
+
+  resamplePath ( T );
+  trace ( TraceDebug, T.Id, "Path", TraceTwoArgs, T.Path.size (), T.Samples.size () );
+
+  for ( i = 0; i < T.Samples.size (); i++ ) {
+	const PathPoint & s = T.Samples[i];
+	for ( k = 0; k < Count; k++ ) {
+	  Target & M = T.Group ? (*T.Group)[k] : T;
+	  waitFor ( M, s.Time - Last );
+	  sendMotion ( M, scale ( s.x ), scale ( s.y ) );
+	  M.PathSent++;
+	}
+	Last = s.Time;
+  }
+
+  for ( k = 0; k < Count; k++ ) {
+	Target & M = T.Group ? (*T.Group)[k] : T;
+	waitFor ( M, M.PathDelay );
+	M.Path.clear ();
+	M.PathDelay = 0;
+  }
+}
+
+/****************************************************************************/
+/*! Takes the command \a ev into the path of \a T when resampling motions.
+    Returns false if it ends the path, which is played then, or isn't part
+	of one, and it has to be played as it is.
+*/
+/****************************************************************************/
+bool collectPath (Target & T, const MacroEvent & ev) {
+
+  PathPoint p;
+
+  if ( MotionRate < 0 ) return false;
+
+  switch ( ev.Op ) {
+	case OpMotionNotify:
+	  trace ( TraceEvent, T.Id, "MotionNotify", TraceTwoArgs, ev.A, ev.B );
+	  // each motion is due a gap after the previous one and its Delays
+	  p.x = ev.A;
+	  p.y = ev.B;
+	  p.Time = ( T.Path.empty () ? 0 : T.Path.back ().Time + T.PathDelay ) + T.Pace.Gap;
+	  T.Path.push_back ( p );
+	  T.PathDelay = 0;
+	  T.PathPoints++;
+	  return true;
+
+	case OpDelay:
+	  if ( T.Path.empty () ) return false;
+	  trace ( TraceEvent, T.Id, "Delay", TraceSeconds, ev.A, ev.B );
+	  T.PathDelay += delayUsec ( ev );
+	  return true;
+
+	case OpComment:
+	  return false;
+
+	default:
+	  playPath ( T );
+	  return false;
+  }
+}
+
+/****************************************************************************/
+/*! Returns true if the macro stamped with the KeyMap command \a ev was
+    specialized by xmacroc for the keyboard mapping of \a T, else tells so.
+	The mapping was fetched at startup, comparing costs no request.
+*/
+/****************************************************************************/
+bool keyMapMatches (const Target & T, const MacroEvent & ev) {
+
+  uint64_t Have = keyMapFingerprint ( T.Keys );
+
+  if ( macroKeyMap ( ev ) == Have ) return true;
+
+  cerr << PROG << ": the macro was compiled for the keyboard mapping " << hex << setfill ('0')
+	   << setw (16) << macroKeyMap ( ev ) << ", " << DisplayString ( T.Dpy ) << " has "
+	   << setw (16) << Have << dec << setfill (' ') << "." << endl;
+  return false;
+}
+
+/****************************************************************************/
+/*! Returns true unless the compiled macro \a File starts with a KeyMap
+    command for another keyboard mapping than that of \a T. Its keycodes
+	would type other keys there, so it must not be played.
+*/
+/****************************************************************************/
+bool checkKeyMap (const Target & T, const MacroFile & File) {
+
+  return File.First == File.End || File.First->Op != OpKeyMap
+	|| keyMapMatches ( T, *File.First );
+}
+
+/****************************************************************************/
+/*! Plays a single macro command \a ev on the remote display. \a Text is the
+    argument of a String command (\c ev.Len bytes), or the keysym name of a
+	KeyStr command if known (else it is looked up from the keysym).
+
+    \arg Target & T - used display.
+	\arg const MacroEvent & ev - the command.
+	\arg const char * Text - text belonging to the command.
+*/
+/****************************************************************************/
+void playEvent (Target & T, const MacroEvent & ev, const char * Text) {
+
+  KeySym ks = (KeySym)(uint32_t) ev.A;
+  KeyCode kc;
+  long long Usec;
+  MacroRegion Region;
+  char Args[64];
+
+  if ( collectPath ( T, ev ) ) return;
+
+  switch ( ev.Op ) {
+	case OpComment:
+	  traceText ( TraceEvent, T.Id, "Comment", Text, Text ? strlen ( Text ) : 0 );
+	  break;
+
+	case OpDelay:
+	  trace ( TraceEvent, T.Id, "Delay", TraceSeconds, ev.A, ev.B );
+	  waitFor ( T, delayUsec ( ev ) );
+	  break;
+
+	case OpButtonPress:
+	  trace ( TraceEvent, T.Id, "ButtonPress", TraceOneArg, ev.A );
+	  fakeButton ( T, ev.A, True );
+	  break;
+
+	case OpButtonRelease:
+	  trace ( TraceEvent, T.Id, "ButtonRelease", TraceOneArg, ev.A );
+	  fakeButton ( T, ev.A, False );
+	  break;
+
+	case OpMotionNotify:
+	  trace ( TraceEvent, T.Id, "MotionNotify", TraceTwoArgs, ev.A, ev.B );
+	  fakeMotion ( T, scale ( ev.A ), scale ( ev.B ) );
+	  break;
+
+	case OpKeyCodePress:
+	  trace ( TraceEvent, T.Id, "KeyPress", TraceOneArg, ev.A );
+	  fakeKey ( T, ev.A, True );
+	  break;
+
+	case OpKeyCodeRelease:
+	  trace ( TraceEvent, T.Id, "KeyRelease", TraceOneArg, ev.A );
+  	  fakeKey ( T, ev.A, False );
+	  break;
+
+	case OpKeySym:
+	case OpKeySymPress:
+	case OpKeySymRelease:
+	  trace ( TraceEvent, T.Id, macroOpName ( ev.Op ), TraceOneArg, ev.A );
+	  if ( ( kc = keysymToKeycode ( T.Keys, ks ) ) == 0 )
+	  {
+	  	trace ( TraceWarn, T.Id, "No keycode on remote display for keysym", TraceOneArg, ks );
+	  	break;
+	  }
+	  if ( ev.Op != OpKeySymRelease ) fakeKey ( T, kc, True );
+	  if ( ev.Op != OpKeySymPress ) fakeKey ( T, kc, False );
+	  break;
+
+	case OpKeyStr:
+	case OpKeyStrPress:
+	case OpKeyStrRelease:
+	  if ( ! Text ) Text = XKeysymToString ( ks );
+	  if ( ! Text ) Text = "";
+	  traceText ( TraceEvent, T.Id, macroOpName ( ev.Op ), Text, strlen ( Text ) );
+	  if ( ( kc = keysymToKeycode ( T.Keys, ks ) ) == 0 )
+	  {
+	  	if ( tracing ( TraceWarn ) )
+		  traceWrite ( TraceWarn, T.Id, "No keycode on remote display for keysym",
+					   TraceOneArg, ks, 0, Text, strlen ( Text ) );
+	  	break;
+	  }
+	  if ( ev.Op != OpKeyStrRelease ) fakeKey ( T, kc, True );
+	  if ( ev.Op != OpKeyStrPress ) fakeKey ( T, kc, False );
+	  break;
+
+	case OpString:
+	  traceText ( TraceEvent, T.Id, "String", Text, ev.Len );
+	  // the selection is served as UTF-8, so only UTF-8 Strings are pasted
+	  if ( PasteThreshold && ! Charset && ev.Len >= PasteThreshold )
+		pasteText ( T, Text, ev.Len );
+	  else sendString ( T, Text, ev.Len );
+	  break;
+
+	case OpPaste:
+	  traceText ( TraceEvent, T.Id, "Paste", Text, ev.Len );
+	  pasteText ( T, Text, ev.Len );
+	  break;
+
+	case OpWaitForWindow:
+	case OpWaitForMap:
+	case OpWaitForFocus:
+	  traceText ( TraceEvent, T.Id, macroOpName ( ev.Op ), Text, ev.Len );
+	  waitForWindow ( T, ev.Op, string ( Text ? Text : "", ev.Len ), 0 );
+	  break;
+
+	case OpWaitForIdle:
+	  Usec = ev.A * 1000000LL + ev.B;
+	  trace ( TraceEvent, T.Id, "WaitForIdle", TraceSeconds, ev.A, ev.B );
+	  waitForWindow ( T, ev.Op, "", Usec );
+	  break;
+
+	case OpWaitForPixels:
+	case OpWaitForChange:
+	  // the payload may not be aligned in a compiled file
+	  memcpy ( &Region, Text, sizeof (Region) );
+	  if ( tracing ( TraceEvent ) ) {
+		snprintf ( Args, sizeof (Args), ev.Op == OpWaitForPixels ? "%d %d %dx%d %016llx"
+				   : "%d %d %dx%d", ev.A, ev.B, Region.W, Region.H,
+				   (unsigned long long) Region.Hash );
+		traceText ( TraceEvent, T.Id, macroOpName ( ev.Op ), Args, strlen ( Args ) );
+	  }
+	  waitForPixels ( T, ev.Op, ev.A, ev.B, Region );
+	  break;
+
+	case OpKeyMap:
+	  // compiled macros are checked before they are played, text ones here
+	  trace ( TraceEvent, T.Id, "KeyMap", TraceTwoArgs, ev.A, ev.B );
+	  if ( ! keyMapMatches ( T, ev ) )
+		trace ( TraceWarn, T.Id, "The keycodes of the macro may type other keys" );
+	  break;
+
+	case OpUnknown:
+	  traceText ( TraceWarn, T.Id, "Unknown tag", Text, Text ? strlen ( Text ) : 0 );
+	  break;
+  }
+}
+
+/****************************************************************************/
+/*! Parses the text macro from \a Reader into \a Events until the end of
+    input. Runs in a thread of its own, never touching the display.
+*/
+/****************************************************************************/
+void parseMacro (MacroReader * Reader, EventRing * Events) {
+
+  ParsedEvent * Slot;
+  MacroEvent ev;
+  const char * Text;
+
+  while ( readMacroEvent ( *Reader, ev, Text ) ) {
+	Slot = ringSlot ( *Events );
+	Slot->Ev = ev;
+	Slot->HasText = Text != 0;
+	if ( ev.Len ) Slot->Text.assign ( Text, ev.Len );
+	else if ( Text ) Slot->Text.assign ( Text );
+	ringPush ( *Events );
+  }
+
+  ringClose ( *Events );
+}
+
+/****************************************************************************/
+/*! Main event-loop of the application. Plays the text macro from \a Reader
+    on the remote display while a second thread parses it. When we run out
+	of parsed commands, what is queued is flushed before waiting for more,
+	and the timeline goes on from when they came.
+	Returns the number of commands played.
+
+    \arg Target & T - used display.
+	\arg MacroReader & Reader - the macro text.
+*/
+/****************************************************************************/
+unsigned long eventLoop (Target & T, MacroReader & Reader) {
+
+  EventRing * Events = new EventRing;
+  ParsedEvent * Slot;
+  unsigned long Count = 0;
+
+  thread Parser ( parseMacro, &Reader, Events );
+
+  startTimeline ( T );
+  while ( true ) {
+	if ( ! ( Slot = ringPeek ( *Events ) ) ) {
+	  flushBatch ( T );
+	  if ( ! ( Slot = ringWait ( *Events ) ) ) break;
+	  // the time spent waiting for input is not made up for
+	  catchUp ( T );
+	}
+	playEvent ( T, Slot->Ev, Slot->HasText ? Slot->Text.data () : 0 );
+	ringPop ( *Events );
+	Count++;
+  }
+
+  Parser.join ();
+  delete Events;
+
+  // sync the remote server
+  playPath ( T );
+  flushBatch ( T );
+  return Count;
+}
+
+/****************************************************************************/
+/*! Plays a compiled macro mapped into memory. The events are used right
+    where they are, there is no parsing or allocation per event. The timeline
+	of \a T must have been started. Returns the number of commands played.
+
+    \arg Target & T - used display.
+	\arg const MacroFile & File - the compiled macro.
+*/
+/****************************************************************************/
+unsigned long playMacro (Target & T, const MacroFile & File) {
+
+  const MacroEvent * ev;
+
+  for ( ev = File.First; ev < File.End; ev = macroNext ( ev ) ) {
+	playEvent ( T, *ev, ev->Len ? macroPayload ( ev ) : 0 );
+  }
+
+  // sync the remote server
+  playPath ( T );
+  flushBatch ( T );
+  return File.Count;
+}
+
+/****************************************************************************/
+/*! Replaces the compiled macro \a File with its optimized version, which is
+    kept in \a Image. \a File may be mapped or in \a Image already.
+*/
+/****************************************************************************/
+void optimizeFile (MacroFile & File, string & Image) {
+
+  OptimizeStats Stats;
+  string Out;
+
+  optimizeMacro ( File, Out, Stats );
+  unmapMacro ( File );
+  Image.swap ( Out );
+  bufferMacro ( Image.data (), Image.size (), File );
+  trace ( TraceInfo, 0, "Optimized", TraceTwoArgs, Stats.Before, Stats.After );
+}
+
+/****************************************************************************/
+/*! Plays the compiled macro \a File on the display of \a T until done and
+    notes when its server had seen all of it. Runs in a thread of its own
+	when the displays are free-running.
+*/
+/****************************************************************************/
+void playTarget (Target * T, const MacroFile * File) {
+
+  playMacro ( *T, *File );
+  XSync ( T->Dpy, False );
+  clock_gettime ( CLOCK_MONOTONIC, &T->Done );
+}
+
+/****************************************************************************/
+/*! Plays the compiled macro \a File on all displays in \a Targets, starting
+    them on a common timeline. Free-running, each display is fed by its own
+	thread and only waits for its own server. In lockstep a command goes to
+	every display before the next command is played, so the displays never
+	drift further apart than one command.
+
+    \arg deque<Target> & Targets - the displays.
+	\arg const MacroFile & File - the compiled macro.
+*/
+/****************************************************************************/
+void fanOut (deque<Target> & Targets, const MacroFile & File) {
+
+  vector<thread> Threads;
+  const MacroEvent * ev;
+  struct timespec Start;
+  long long Late, First = -1;
+  size_t i;
+
+  clock_gettime ( CLOCK_MONOTONIC, &Start );
+  for ( i = 0; i < Targets.size (); i++ ) {
+	Targets[i].Deadline = Start;
+	if ( Lockstep ) Targets[i].Group = &Targets;
+  }
+
+  if ( Lockstep ) {
+	for ( ev = File.First; ev < File.End; ev = macroNext ( ev ) )
+	  for ( i = 0; i < Targets.size (); i++ )
+		playEvent ( Targets[i], *ev, ev->Len ? macroPayload ( ev ) : 0 );
+
+	if ( ! Targets.empty () ) playPath ( Targets[0] );
+	for ( i = 0; i < Targets.size (); i++ ) flushBatch ( Targets[i] );
+	for ( i = 0; i < Targets.size (); i++ ) {
+	  XSync ( Targets[i].Dpy, False );
+	  clock_gettime ( CLOCK_MONOTONIC, &Targets[i].Done );
+	}
+  }
+  else {
+	for ( i = 0; i < Targets.size (); i++ )
+	  Threads.push_back ( thread ( playTarget, &Targets[i], &File ) );
+	for ( i = 0; i < Threads.size (); i++ ) Threads[i].join ();
+  }
+
+  // the skew is how much later than the first display each one was done
+  for ( i = 0; i < Targets.size (); i++ ) {
+	Late = elapsed ( Start, Targets[i].Done );
+	if ( First < 0 || Late < First ) First = Late;
+  }
+
+  cerr << PROG << ": played " << File.Count << " commands on " << Targets.size ()
+	   << " displays, " << ( Lockstep ? "in lockstep" : "free-running" ) << "." << endl;
+  for ( i = 0; i < Targets.size (); i++ ) {
+	Late = elapsed ( Start, Targets[i].Done );
+	cerr << "  " << setw (16) << left << DisplayString ( Targets[i].Dpy ) << right
+		 << " done after " << setw (9) << Late / 1000 << "."
+		 << setfill ('0') << setw (3) << Late % 1000 << setfill (' ')
+		 << " ms, skew " << setw (6) << ( Late - First ) / 1000 << "."
+		 << setfill ('0') << setw (3) << ( Late - First ) % 1000 << setfill (' ')
+		 << " ms" << endl;
+  }
+}
+
+/****************************************************************************/
+/*! Set by the signal handler to end the daemon.
+*/
+/****************************************************************************/
+volatile sig_atomic_t Quit = 0;
+
+void quitSignal (int) {
+
+  Quit = 1;
+}
+
+/****************************************************************************/
+/*! A macro submitted to the daemon. It is read until the client shuts down
+    its side of the connection, then queued and played in turn.
+*/
+/****************************************************************************/
+struct Request {
+  int    Fd;
+  string Data;
+};
+
+/****************************************************************************/
+/*! Sends the status line \a Line to the client of \a Req. The client may
+    have gone already, that is no error.
+*/
+/****************************************************************************/
+void reply (const Request & Req, const string & Line) {
+
+  send ( Req.Fd, Line.data (), Line.size (), MSG_NOSIGNAL );
+}
+
+/****************************************************************************/
+/*! Plays the macro of \a Req, text or compiled, and returns the status line
+    for its client.
+*/
+/****************************************************************************/
+string playRequest (Target & T, Request & Req) {
+
+  struct timespec Start, End;
+  unsigned long Count;
+  MacroReader Reader;
+  MacroFile File;
+  ostringstream Result;
+  string Image;
+  int Kind;
+
+  clock_gettime ( CLOCK_MONOTONIC, &Start );
+
+  Kind = bufferMacro ( Req.Data.data (), Req.Data.size (), File );
+  if ( Optimize && Kind == 0 ) {
+	openMacroBuffer ( Reader, Req.Data.data (), Req.Data.size () );
+	compileMacro ( Reader, Image );
+	closeMacroReader ( Reader );
+	Kind = bufferMacro ( Image.data (), Image.size (), File );
+  }
+  if ( Optimize && Kind == 1 ) optimizeFile ( File, Image );
+  if ( Kind == 1 && ! checkKeyMap ( T, File ) ) {
+	Result << "ERR the macro was compiled for another keyboard mapping" << endl;
+	return Result.str ();
+  }
+
+  switch ( Kind ) {
+	case 1:
+	  startTimeline ( T );
+	  Count = playMacro ( T, File );
+	  break;
+
+	case -1:
+	  Result << "ERR compiled macro is not version " << MacroVersion
+			 << " for this machine" << endl;
+	  return Result.str ();
+
+	default:
+	  openMacroBuffer ( Reader, Req.Data.data (), Req.Data.size () );
+	  Count = eventLoop ( T, Reader );
+	  closeMacroReader ( Reader );
+	  break;
+  }
+
+  // the macro is done when the server has seen all of it
+  XSync ( T.Dpy, False );
+  clock_gettime ( CLOCK_MONOTONIC, &End );
+
+  Result << "DONE " << Count << " "
+		 << ( End.tv_sec - Start.tv_sec ) * 1000000LL
+			+ ( End.tv_nsec - Start.tv_nsec ) / 1000 << endl;
+  return Result.str ();
+}
+
+/****************************************************************************/
+/*! Creates the listening Unix socket at \a Path, replacing a stale one.
+    Only the owner may connect to it.
+*/
+/****************************************************************************/
+int listenSocket (const char * Path) {
+
+  struct sockaddr_un Addr;
+  mode_t Old;
+  int Fd, Bound;
+
+  if ( strlen ( Path ) >= sizeof (Addr.sun_path) ) {
+	cerr << PROG << ": socket path \"" << Path << "\" is too long." << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  memset ( &Addr, 0, sizeof (Addr) );
+  Addr.sun_family = AF_UNIX;
+  strcpy ( Addr.sun_path, Path );
+
+  Fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+  unlink ( Path );
+
+  // no one else may connect even for the moment between bind and a chmod
+  Old = umask ( 077 );
+  Bound = Fd < 0 ? -1 : bind ( Fd, (struct sockaddr *) &Addr, sizeof (Addr) );
+  umask ( Old );
+
+  if ( Fd < 0 || Bound || listen ( Fd, 64 ) ) {
+	cerr << PROG << ": could not listen on \"" << Path << "\": "
+		 << strerror ( errno ) << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  return Fd;
+}
+
+/****************************************************************************/
+/*! Runs xmacroplay as a daemon: the remote display stays open and macros
+    are accepted on the Unix socket \a Socket. Each client sends one macro,
+	text or compiled, and shuts down its side of the connection. It is told
+	"QUEUED <n>" when the macro is complete, with n macros ahead of it, and
+	"DONE <commands> <microseconds>" or "ERR <reason>" when it was played.
+
+    \arg Target & T - used display.
+*/
+/****************************************************************************/
+void runDaemon (Target & T) {
+
+  vector<Request> Reading;
+  deque<Request> Queue;
+  vector<struct pollfd> Fds;
+  struct sigaction Action;
+  char Buf[MacroReadBlock];
+  ostringstream Line;
+  size_t i;
+  ssize_t n;
+  int Listen, Fd;
+
+  memset ( &Action, 0, sizeof (Action) );
+  Action.sa_handler = quitSignal;
+  sigaction ( SIGINT, &Action, 0 );
+  sigaction ( SIGTERM, &Action, 0 );
+
+  Listen = listenSocket ( Socket );
+  cerr << PROG << ": waiting for macros on \"" << Socket << "\"." << endl;
+
+  while ( ! Quit ) {
+	// the listening socket, the display and everyone still sending
+	Fds.clear ();
+	Fds.push_back ( pollIn ( Listen ) );
+	Fds.push_back ( pollIn ( ConnectionNumber ( T.Dpy ) ) );
+	for ( i = 0; i < Reading.size (); i++ )
+	  Fds.push_back ( pollIn ( Reading[i].Fd ) );
+
+	// don't sleep while there is work queued
+	if ( poll ( &Fds[0], Fds.size (), Queue.empty () ? -1 : 0 ) < 0 ) {
+	  if ( errno == EINTR ) continue;
+	  break;
+	}
+
+	if ( Fds[0].revents & POLLIN ) {
+	  Fd = accept4 ( Listen, 0, 0, SOCK_CLOEXEC );
+	  if ( Fd >= 0 ) {
+		Reading.push_back ( Request () );
+		Reading.back ().Fd = Fd;
+	  }
+	}
+
+	if ( Fds[1].revents & POLLIN ) processEvents ( T );
+
+	// read what the clients sent, queue the complete macros
+	for ( i = Reading.size (); i-- > 0; ) {
+	  if ( ! Fds[i + 2].revents ) continue;
+
+	  n = read ( Reading[i].Fd, Buf, sizeof (Buf) );
+	  if ( n > 0 ) {
+		Reading[i].Data.append ( Buf, n );
+		continue;
+	  }
+	  if ( n < 0 && errno == EINTR ) continue;
+
+	  if ( n < 0 ) close ( Reading[i].Fd );
+	  else {
+		Line.str ( "" );
+		Line << "QUEUED " << Queue.size () << endl;
+		reply ( Reading[i], Line.str () );
+		Queue.push_back ( Reading[i] );
+	  }
+	  Reading.erase ( Reading.begin () + i );
+	}
+
+	// play the oldest macro, then look at the sockets again
+	if ( ! Queue.empty () ) {
+	  reply ( Queue.front (), playRequest ( T, Queue.front () ) );
+	  close ( Queue.front ().Fd );
+	  Queue.pop_front ();
+	}
+  }
+
+  for ( i = 0; i < Reading.size (); i++ ) close ( Reading[i].Fd );
+  for ( i = 0; i < Queue.size (); i++ ) {
+	reply ( Queue[i], "ERR daemon stopped\n" );
+	close ( Queue[i].Fd );
+  }
+
+  close ( Listen );
+  unlink ( Socket );
+}
+
+/****************************************************************************/
+/*! Sends the macro open on \a Fd to the daemon listening on \a Socket and
+    prints its replies. Exits successfully if the macro was played.
+*/
+/****************************************************************************/
+void submitMacro (int Fd) {
+
+  struct sockaddr_un Addr;
+  char Buf[MacroReadBlock];
+  string Replies;
+  ssize_t n, Done;
+  int Sock;
+
+  memset ( &Addr, 0, sizeof (Addr) );
+  Addr.sun_family = AF_UNIX;
+  strncpy ( Addr.sun_path, Socket, sizeof (Addr.sun_path) - 1 );
+
+  Sock = socket ( AF_UNIX, SOCK_STREAM, 0 );
+  if ( Sock < 0 || connect ( Sock, (struct sockaddr *) &Addr, sizeof (Addr) ) ) {
+	cerr << PROG << ": could not connect to \"" << Socket << "\": "
+		 << strerror ( errno ) << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  while ( ( n = read ( Fd, Buf, sizeof (Buf) ) ) > 0 || ( n < 0 && errno == EINTR ) ) {
+	for ( Done = 0; n > 0 && Done < n; ) {
+	  ssize_t w = send ( Sock, Buf + Done, n - Done, MSG_NOSIGNAL );
+	  if ( w < 0 && errno == EINTR ) continue;
+	  if ( w < 0 ) {
+		cerr << PROG << ": daemon went away: " << strerror ( errno ) << endl;
+		exit ( EXIT_FAILURE );
+	  }
+	  Done += w;
+	}
+  }
+  shutdown ( Sock, SHUT_WR );
+
+  while ( ( n = read ( Sock, Buf, sizeof (Buf) ) ) > 0 || ( n < 0 && errno == EINTR ) )
+	if ( n > 0 ) Replies.append ( Buf, n );
+
+  cout << Replies << flush;
+  exit ( Replies.find ( "DONE " ) != string::npos ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+
+/****************************************************************************/
+/*! Main function of the application. It expects no commandline arguments.
+
+    \arg int argc - number of commandline arguments.
+	\arg char * argv[] - vector of the commandline argument strings.
+*/
+/****************************************************************************/
+int main (int argc, char * argv[]) {
+
+  // parse commandline arguments
+  parseCommandLine ( argc, argv );
+
+  if ( ! traceOpen ( TracePath, Trace ) ) {
+	cerr << PROG << ": could not open trace file \"" << TracePath << "\"." << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  // we don't mix stdio and iostream output
+  ios::sync_with_stdio ( false );
+
+  // open the macro, compiled macros are played straight from the mapping
+  int Fd = Input ? open ( Input, O_RDONLY ) : 0;
+  MacroFile File;
+  MacroReader Reader;
+  string Image;
+  int Compiled;
+
+  if ( Fd < 0 ) {
+	cerr << PROG << ": could not open \"" << Input << "\", aborting." << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  // just hand the macro to a running daemon?
+  if ( Socket && ! Daemon ) submitMacro ( Fd );
+
+  Compiled = Daemon ? 0 : mapMacro ( Fd, File );
+  if ( Compiled < 0 ) {
+	cerr << PROG << ": compiled macro is not version " << MacroVersion
+		 << " for this machine, recompile it with xmacroc." << endl;
+	exit ( EXIT_FAILURE );
+  }
+
+  // the displays share nothing, but Xlib has some global state; and the
+  // thread parsing a text macro looks keysym names up while we play
+  if ( ( Remotes.size () > 1 && ! Lockstep )
+	   || ( ! Compiled && Remotes.size () == 1 && ! Optimize ) )
+	XInitThreads ();
+
+  // windows may go away while the WaitFor commands look at them
+  ignoreVanishedWindows ();
+
+  // open the remote displays or abort
+  deque<Target> Targets ( Remotes.size () );
+  size_t i;
+
+  for ( i = 0; i < Targets.size (); i++ ) {
+	Target & T = Targets[i];
+
+	T.Dpy = remoteDisplay ( Remotes[i] );
+
+	// get the screens too
+	T.Screen = DefaultScreen ( T.Dpy );
+	T.Id = i;
+
+	XTestDiscard ( T.Dpy );
+
+#ifdef HAVE_XCB
+	// the requests go out on the connection Xlib opened
+	if ( UseXcb ) T.Conn = XGetXCBConnection ( T.Dpy );
+#endif
+
+	// fetch the keyboard mapping so keysyms resolve without the server
+	loadKeyMap ( T.Dpy, T.Keys );
+	selectKeyMapEvents ( T.Dpy, T.Keys );
+  }
+
+  struct timespec Start, End;
+  clock_gettime ( CLOCK_MONOTONIC, &Start );
+
+  if ( Daemon ) runDaemon ( Targets[0] );
+  else switch ( Compiled ) {
+	case 1:
+	  // start the compiled event loop
+	  if ( Optimize ) optimizeFile ( File, Image );
+	  for ( i = 0; i < Targets.size (); i++ )
+		if ( ! checkKeyMap ( Targets[i], File ) ) exit ( EXIT_FAILURE );
+	  if ( Targets.size () > 1 ) fanOut ( Targets, File );
+	  else {
+		startTimeline ( Targets[0] );
+		playMacro ( Targets[0], File );
+	  }
+	  unmapMacro ( File );
+	  break;
+
+	default:
+	  openMacroReader ( Reader, Fd );
+	  if ( Targets.size () > 1 || Optimize ) {
+		// parse the macro once, all displays play the compiled events
+		compileMacro ( Reader, Image );
+		bufferMacro ( Image.data (), Image.size (), File );
+		if ( Optimize ) optimizeFile ( File, Image );
+		for ( i = 0; i < Targets.size (); i++ )
+		  if ( ! checkKeyMap ( Targets[i], File ) ) exit ( EXIT_FAILURE );
+		if ( Targets.size () > 1 ) fanOut ( Targets, File );
+		else {
+		  startTimeline ( Targets[0] );
+		  playMacro ( Targets[0], File );
+		}
+	  }
+	  // start the main event loop
+	  else eventLoop ( Targets[0], Reader );
+	  closeMacroReader ( Reader );
+	  break;
+  }
+
+  if ( Input ) close ( Fd );
+
+  if ( FlushStats && ! Daemon ) {
+	// the macro is done when the servers have seen all of it
+	for ( i = 0; i < Targets.size (); i++ ) XSync ( Targets[i].Dpy, False );
+	clock_gettime ( CLOCK_MONOTONIC, &End );
+	cerr << PROG << ": played in " << elapsed ( Start, End ) << " us with the "
+		 << ( UseXcb ? "xcb" : "xlib" ) << " backend." << endl;
+  }
+
+  for ( i = 0; i < Targets.size (); i++ ) {
+	if ( FlushStats ) reportBatches ( Targets[i] );
+
+	if ( Targets[i].Sel.Win != None ) XDestroyWindow ( Targets[i].Dpy, Targets[i].Sel.Win );
+	closeGrab ( Targets[i].Dpy, Targets[i].Region );
+
+	// the spare keycodes we used are empty again
+	releaseSpareKeys ( Targets[i].Dpy, Targets[i].Keys );
+
+	// discard and even flush all events on the remote display
+	XTestDiscard ( Targets[i].Dpy );
+	XFlush ( Targets[i].Dpy ); 
+
+	// we're done with the display
+	XCloseDisplay ( Targets[i].Dpy );
+  }
 
   cerr << PROG << ": pointer and keyboard released. " << endl;
+  traceClose ();
   
   // go away
   exit ( EXIT_SUCCESS );
@@ -27,7 +27,6 @@
  * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  *	
  ****************************************************************************/
-//#define DEBUG
 /***************************************************************************** 
  * Do we have config.h?
  ****************************************************************************/
@@ -40,6 +39,13 @@
  ****************************************************************************/
 #include <stdio.h>		
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
 #include <X11/Xlibint.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
@@ -48,6 +54,13 @@
 #include <X11/keysym.h>
 #include <X11/extensions/record.h>
 
+#include "capture.h"
+#include "macro.h"
+#include "keymap.h"
+#include "region.h"
+#include "ring.h"
+#include "trace.h"
+
 /***************************************************************************** 
  * What iostream do we have?
  ****************************************************************************/
@@ -59,6 +72,9 @@
 #include <iostream.h>
 #include <iomanip.h>
 #endif
+#include <string>
+#include <thread>
+#include <vector>
 
 #define PROG "xmacrorec2"
 
@@ -87,15 +103,86 @@ using namespace std;
 unsigned int QuitKey;
 bool HasQuitKey = false;
 
+/***************************************************************************** 
+ * Key used for checkpoints: instead of being recorded it emits a
+ * WaitForPixels for the region of RegionWidth x RegionHeight pixels around
+ * the pointer, so the playback waits until the screen looks the same.
+ ****************************************************************************/
+const int DefaultRegionSize = 32;
+
+unsigned int CheckKey;
+bool HasCheckKey = false;
+int  RegionWidth = DefaultRegionSize;
+int  RegionHeight = DefaultRegionSize;
+
+/***************************************************************************** 
+ * What is traced (see trace.h) and where to, 0 for the standard error.
+ ****************************************************************************/
+int    Trace = TraceWarn;
+char * TracePath = 0;
+
+/***************************************************************************** 
+ * Emit Delay lines with the time between the recorded events?
+ ****************************************************************************/
+bool Timing = false;
+
+/*****************************************************************************
+ * Drags are simplified to stay within Tolerance pixels of the path (0 keeps
+ * every point), with a point at least every Resolution ms.
+ ****************************************************************************/
+int      Tolerance = 0;
+uint32_t Resolution = DefaultResolution;
+
+/***************************************************************************** 
+ * The recorded events are not written in the XRecord callback: it puts
+ * them into a ring, as MacroEvent records, and a writer thread formats and
+ * writes them. If the ring is full the event is dropped and counted, the
+ * callback never waits. What the writer formatted is written out
+ *   FlushEvent - as soon as it has it (e.g. when piping into xmacroplay),
+ *   FlushTick  - every TickInterval microseconds,
+ *   FlushFull  - in blocks of WriteBlock bytes,
+ * and at the latest with WriteBlock bytes. With Fsync every write is
+ * synced to the disk. A Raw capture puts the data of the server into a
+ * ring of CaptureRecords instead and writes them as they are.
+ ****************************************************************************/
+const size_t    RecordRingSize = 8192;
+const size_t    WriteBlock = 1 << 16;
+const long long TickInterval = 100000;
+const int       StatTicks = 50;
+
+enum FlushPolicy { FlushEvent, FlushTick, FlushFull };
+
+int  Flush = FlushTick;
+bool Fsync = false;
+bool Raw = false;
+
+struct RecordedEvent {
+  MacroEvent  Ev;
+  MacroRegion Region;		// of a WaitForPixels
+};
+
+typedef Ring<RecordedEvent, RecordRingSize> RecordRing;
+typedef Ring<CaptureRecord, RecordRingSize> CaptureRing;
+
+std::atomic<bool> FlushDue { false };
+std::atomic<bool> WriteFailed { false };
+
 /***************************************************************************** 
  * Private data used in eventCallback.
  ****************************************************************************/
 typedef struct
 {
-	int Status1, Status2, x, y, mmoved, doit;
-	unsigned int QuitKey;
+	int doit;
+	unsigned int QuitKey, CheckKey;
+	int Screen;
 	Display *LocalDpy, *RecDpy;
 	XRecordContext rc;
+	KeyMap Keys;
+	RegionGrab Region;
+	EventDecoder Dec;
+	RecordRing *Events;
+	CaptureRing *Raw;
+	unsigned long Recorded, Dropped, KeysCaptured;
 } Priv;
 
 /****************************************************************************/
@@ -113,6 +200,23 @@ void usage (const int exitCode) {
   cerr << "Options: " << endl;
   cerr << "  -s  FACTOR  scalefactor for coordinates. Default: 1.0." << endl
 	   << "  -k  KEYCODE the keycode for the key used for quitting." << endl
+	   << "  -c  KEYCODE the keycode for the key setting a checkpoint." << endl
+	   << "  -r  WxH     size of the checkpoint region. Default: 32x32." << endl
+	   << "  -t          emit Delay lines with the recorded timing." << endl
+	   << "  --flush P   write the events out as they come (event), every 100ms" << endl
+	   << "              (tick) or in 64k blocks (full). Default: tick." << endl
+	   << "  --fsync     sync every write of the events to the disk." << endl
+	   << "  --simplify PIXELS" << endl
+	   << "              keep only the points of a drag needed to stay within" << endl
+	   << "              PIXELS of its path. Default: every point." << endl
+	   << "  --resolution TIME" << endl
+	   << "              keep a point of a simplified drag at least every TIME." << endl
+	   << "              Default: 100ms, 0 for none." << endl
+	   << "  --raw       write a raw capture for xmacrodecode instead of the macro." << endl
+	   << "  --trace L   trace up to level L: off, warn, info, event (the recorded" << endl
+	   << "              events) or debug. Default: warn." << endl
+	   << "  --trace-file FILE" << endl
+	   << "              write the trace to FILE instead of the standard error." << endl
 	   << "  -v          show version. " << endl
 	   << "  -h          this help. " << endl << endl;
 
@@ -146,6 +250,7 @@ void version () {
 void parseCommandLine (int argc, char * argv[]) {
 
   int Index = 1;
+  int32_t Sec, Usec;
   
   // loop through all arguments except the last, which is assumed to be the
   // name of the display
@@ -176,6 +281,12 @@ void parseCommandLine (int argc, char * argv[]) {
 	  Index++;
 	}
 
+	// is this '-t'?
+	else if ( strcmp (argv[Index], "-t" ) == 0 ) {
+	  // yep, keep the timing of the events
+	  Timing = true;
+	}
+
     // is this '-k'?
 	else if ( strcmp (argv[Index], "-k" ) == 0 && Index + 1 < argc ) {
 	  // yep, and there seems to be a parameter too, interpret it as a
@@ -190,6 +301,99 @@ void parseCommandLine (int argc, char * argv[]) {
 	  HasQuitKey = true;
 	  Index++;
 	}
+
+	// is this '-c'?
+	else if ( strcmp (argv[Index], "-c" ) == 0 && Index + 1 < argc ) {
+	  // yep, and there seems to be a parameter too, interpret it as a
+	  // keycode
+	  if ( sscanf ( argv[Index + 1], "%u", &CheckKey ) != 1 ) {
+		// oops, not a valid integer
+		cerr << "Invalid parameter for '-c'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  HasCheckKey = true;
+	  Index++;
+	}
+
+	// is this '--flush'?
+	else if ( strcmp (argv[Index], "--flush" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the policy
+	  if ( strcmp ( argv[Index + 1], "event" ) == 0 ) Flush = FlushEvent;
+	  else if ( strcmp ( argv[Index + 1], "tick" ) == 0 ) Flush = FlushTick;
+	  else if ( strcmp ( argv[Index + 1], "full" ) == 0 ) Flush = FlushFull;
+	  else {
+		cerr << "Invalid parameter for '--flush'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--fsync'?
+	else if ( strcmp (argv[Index], "--fsync" ) == 0 ) {
+	  // yep, sync the output after every write
+	  Fsync = true;
+	}
+
+	// is this '--simplify'?
+	else if ( strcmp (argv[Index], "--simplify" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the tolerance in pixels
+	  if ( sscanf ( argv[Index + 1], "%d", &Tolerance ) != 1 || Tolerance < 0 ) {
+		cerr << "Invalid parameter for '--simplify'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--resolution'?
+	else if ( strcmp (argv[Index], "--resolution" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is a duration
+	  if ( ! parseDuration ( argv[Index + 1], Sec, Usec ) || Sec > 1000000 ) {
+		cerr << "Invalid parameter for '--resolution'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Resolution = Sec * 1000 + Usec / 1000;
+	  Index++;
+	}
+
+	// is this '--raw'?
+	else if ( strcmp (argv[Index], "--raw" ) == 0 ) {
+	  // yep, capture what the server sends, xmacrodecode decodes it
+	  Raw = true;
+	}
+
+	// is this '--trace'?
+	else if ( strcmp (argv[Index], "--trace" ) == 0 && Index + 1 < argc ) {
+	  // yep, the parameter is the level
+	  if ( ( Trace = traceLevelByName ( argv[Index + 1] ) ) < 0 ) {
+		cerr << "Invalid parameter for '--trace'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
+
+	// is this '--trace-file'?
+	else if ( strcmp (argv[Index], "--trace-file" ) == 0 && Index + 1 < argc ) {
+	  // yep, write the trace there
+	  TracePath = argv[Index + 1];
+	  Index++;
+	}
+
+	// is this '-r'?
+	else if ( strcmp (argv[Index], "-r" ) == 0 && Index + 1 < argc ) {
+	  // yep, interpret the parameter as WIDTHxHEIGHT
+	  if ( sscanf ( argv[Index + 1], "%dx%d", &RegionWidth, &RegionHeight ) != 2
+		   || RegionWidth <= 0 || RegionHeight <= 0 ) {
+		cerr << "Invalid parameter for '-r'." << endl;
+		usage ( EXIT_FAILURE );
+	  }
+
+	  Index++;
+	}
 	
 	else {
 	  // we got this far, the parameter is no good...
@@ -305,145 +509,337 @@ int scale (const int Coordinate) {
 }
 
 
-#ifdef DEBUG
-#define DBG cerr << "type: " << type << " serial: " << seq << endl; \
-		cerr << "send_event: " << (unsigned int)(ud1[0]>>8) << endl; \
-		cerr << "window:  " << hex << wevent << " root: " << wroot << endl; \
-		cerr << "subwindow:  " << wchild << " time: " << dec << tstamp << endl; \
-		cerr << "x:  " << eventx << " y: " << eventy << endl; \
-		cerr << "x_root:  " << rootx << " y_root: " << rooty << endl; \
-		cerr << "state:  " << kstate << " detail: " << detail << endl; \
-		cerr << "same_screen:  " << samescreen << endl << "------" << endl
-#else
-#define DBG
-#endif
+/****************************************************************************/
+/*! Returns how many records the writer lets pile up in the ring before it
+    wants to be woken. Otherwise it is woken by the ticks.
+*/
+/****************************************************************************/
+size_t wakeThreshold()
+{
+  return Flush == FlushEvent ? 1 : RecordRingSize / 2;
+}
 
-void eventCallback(XPointer priv, XRecordInterceptData *d)
+/****************************************************************************/
+/*! Publishes the record filled in the ring \a Events. The writer is only
+    woken when it wants to be, not for every event.
+*/
+/****************************************************************************/
+template <class Item>
+void publish(Priv *p, Ring<Item, RecordRingSize> &Events)
 {
-  Priv *p=(Priv *) priv;
-  unsigned int *ud4, tstamp, wroot, wevent, wchild, type, detail;
-  unsigned char *ud1, type1, detail1, samescreen;
-  unsigned short *ud2, seq;
-  short *d2, rootx, rooty, eventx, eventy, kstate;
+  p->Recorded++;
+  ringPost(Events);
+  if (ringCount(Events) >= wakeThreshold()) ringWake(Events);
+}
 
-  if (d->category==XRecordStartOfData) cerr << "Got Start Of Data" << endl;
-  if (d->category==XRecordEndOfData) cerr << "Got End Of Data" << endl;
-  if (d->category!=XRecordFromServer || p->doit==0)
+/****************************************************************************/
+/*! Hands the decoded event \a ev and its \a Payload to the writer. If the
+    ring is full it is dropped and counted, we never wait.
+*/
+/****************************************************************************/
+void emitEvent(void *Arg, const MacroEvent &ev, const char *Payload)
+{
+  Priv *p=(Priv *) Arg;
+  RecordedEvent *r=ringTrySlot(*p->Events);
+
+  if (!r)
   {
-	cerr << "Skipping..." << endl;
-  	goto returning;
+	p->Dropped++;
+	return;
   }
-  if (d->client_swapped==True) cerr << "Client is swapped!!!" << endl;
-  ud1=(unsigned char *)d->data;
-  ud2=(unsigned short *)d->data;
-   d2=(short *)d->data;
-  ud4=(unsigned int *)d->data;
-
-  type1=ud1[0]&0x7F; type=type1;
-  detail1=ud1[1]; detail=detail1;
-  seq=ud2[1];
-  tstamp=ud4[1];
-  wroot=ud4[2];
-  wevent=ud4[3];
-  wchild=ud4[4];
-  rootx=d2[10];
-  rooty=d2[11];
-  eventx=d2[12];
-  eventy=d2[13];
-  kstate=d2[14];
-  samescreen=ud1[30];
-
-  if (p->Status1)
+  r->Ev=ev;
+  if (ev.Len) memcpy(&r->Region, Payload, sizeof(r->Region));
+  publish(p, *p->Events);
+}
+
+/****************************************************************************/
+/*! Grabs the checkpoint region around the pointer at \a px, \a py into
+    \a Region. The region is moved inside the screen if the pointer is near
+	an edge, it ends up at \a x, \a y. Returns false if it can't be grabbed.
+*/
+/****************************************************************************/
+bool grabCheckpoint(Priv *p, int px, int py, int &x, int &y, MacroRegion &Region)
+{
+  x=px - p->Region.W/2;
+  y=py - p->Region.H/2;
+  x=max(0, min(x, DisplayWidth(p->LocalDpy, p->Screen) - p->Region.W));
+  y=max(0, min(y, DisplayHeight(p->LocalDpy, p->Screen) - p->Region.H));
+
+  if (!grabRegion(p->LocalDpy, p->Screen, x, y, p->Region))
   {
-	  p->Status1--;
-	  if (type==KeyRelease)
-	  {
-		cerr << "- Skipping stale KeyRelease event. " << p->Status1 << endl;
-		goto returning;
-	  } else p->Status1=0;
+	cerr << "- Could not grab the checkpoint region, no checkpoint set." << endl;
+	return false;
   }
-  if (p->x==-1 && p->y==-1 && p->mmoved==0 && type!=MotionNotify)
+
+  Region.W=p->Region.W;
+  Region.H=p->Region.H;
+  Region.Hash=hashRegion(p->Region.Img);
+  cerr << "Checkpoint at " << x << " " << y << endl;
+  return true;
+}
+
+void eventCallback(XPointer priv, XRecordInterceptData *d)
+{
+  Priv *p=(Priv *) priv;
+  MacroRegion Region;
+  int x, y;
+
+  if (d->category==XRecordStartOfData) trace(TraceInfo, 0, "Got Start Of Data");
+  if (d->category==XRecordEndOfData) trace(TraceInfo, 0, "Got End Of Data");
+  if (d->category!=XRecordFromServer || p->doit==0)
   {
-  	cerr << "- Please move the mouse before any other event to synchronize pointer" << endl;
-  	cerr << "  coordinates! This event is now ignored!" << endl;
+	trace(TraceDebug, 0, "Skipping category", TraceOneArg, d->category);
   	goto returning;
   }
-  // what did we get?
-  switch (type) {
-    case ButtonPress:
-	  // button pressed, create event
-		DBG;
-	  if (p->mmoved)
-	  {
-		cout << "MotionNotify " << p->x << " " << p->y << endl;
-		p->mmoved=0;
-	  }
-	  if (p->Status2<0) p->Status2=0;
-	  p->Status2++;
-	  cout << "ButtonPress " << detail << endl;
-      break;
-
-    case ButtonRelease:
-	  // button released, create event
-		DBG;
-	  if (p->mmoved)
-	  {
-		cout << "MotionNotify " << p->x << " " << p->y << endl;
-		p->mmoved=0;
-	  }
-	  p->Status2--;
-	  if (p->Status2<0) p->Status2=0;
-	  cout << "ButtonRelease " << detail << endl;
-	  break;
+  if (d->client_swapped==True) trace(TraceWarn, 0, "Client is swapped!!!");
 
-	case MotionNotify:
-	  // motion-event, create event
-		DBG;
-	  if (p->Status2>0)
-	  {
-	  	cout << "MotionNotify " << rootx << " " << rooty << endl;
-	  	p->mmoved=0;
-	  }
-	  else p->mmoved=1;
-	  p->x=rootx;
-	  p->y=rooty;
+  switch (decodeEvent(p->Dec, (unsigned char *)d->data))
+  {
+	case DecodeQuit:
+	  // the user pressed the quitkey, no more loops
+	  cerr << "Got QuitKey, so exiting..." << endl;
+	  p->doit=0;
 	  break;
 
-	case KeyPress:
-	  // a key was pressed
-		DBG;
-	  // should we stop looping, i.e. did the user press the quitkey?
-	  if ( detail == p->QuitKey ) {
-		// yep, no more loops
-		cerr << "Got QuitKey, so exiting..." << endl;
-		p->doit=0;
-	  }
-	  else {
-		// send the keycode to the remote server
-		if (p->mmoved)
-		{
-			cout << "MotionNotify " << p->x << " " << p->y << endl;
-			p->mmoved=0;
-		}
-		cout << "KeyStrPress " << XKeysymToString(XKeycodeToKeysym(p->LocalDpy,detail,0)) << endl;
-	  }
+	case DecodeCheckpoint:
+	  // instead of the key a check of the screen is recorded
+	  if (grabCheckpoint(p, p->Dec.x, p->Dec.y, x, y, Region))
+		decodeCheckpoint(p->Dec, p->Dec.Time, x, y, Region);
 	  break;
+  }
+returning:
+  XRecordFreeData(d);
+}
+
+/****************************************************************************/
+/*! Stores the record \a r in the capture, or counts it as dropped if the
+    ring is full.
+*/
+/****************************************************************************/
+void captureRecord(Priv *p, const CaptureRecord &r)
+{
+  CaptureRecord *Slot=ringTrySlot(*p->Raw);
+
+  if (!Slot)
+  {
+	p->Dropped++;
+	return;
+  }
+  *Slot=r;
+  publish(p, *p->Raw);
+}
 
-	case KeyRelease:
-	  // a key was released
-		DBG;
-	  if (p->mmoved)
+/****************************************************************************/
+/*! The callback of a raw capture: what the server sent goes into the ring
+    as it is. Only the quit and checkpoint keys are looked at, they are not
+	captured; a checkpoint record takes the place of the latter.
+*/
+/****************************************************************************/
+void captureCallback(XPointer priv, XRecordInterceptData *d)
+{
+  Priv *p=(Priv *) priv;
+  unsigned char *ud1=(unsigned char *)d->data;
+  short *d2=(short *)d->data;
+  unsigned int Len=d->data_len*4, type;
+  CaptureRecord r;
+  MacroRegion Region;
+  int x, y;
+
+  if (p->doit==0) goto returning;
+  if (d->category==XRecordFromServer && Len>=CaptureDataSize)
+  {
+	type=ud1[0]&0x7F;
+	if (type==KeyPress && ud1[1]==p->QuitKey)
+	{
+	  cerr << "Got QuitKey, so exiting..." << endl;
+	  p->doit=0;
+	  goto returning;
+	}
+	if (HasCheckKey && ud1[1]==p->CheckKey && (type==KeyPress || type==KeyRelease))
+	{
+	  if (type==KeyPress && grabCheckpoint(p, d2[10], d2[11], x, y, Region))
 	  {
-		cout << "MotionNotify " << p->x << " " << p->y << endl;
-		p->mmoved=0;
+		captureCheckpoint(r, d->server_time, x, y, Region);
+		captureRecord(p, r);
 	  }
-	  cout << "KeyStrRelease " << XKeysymToString(XKeycodeToKeysym(p->LocalDpy,detail,0)) << endl;
-	  break;
+	  goto returning;
+	}
+  }
+  if (Len>CaptureDataSize)
+  {
+	trace(TraceWarn, 0, "Data too long for the capture, dropped", TraceOneArg, Len);
+	p->Dropped++;
+	goto returning;
   }
+
+  r.Time=d->server_time;
+  r.Kind=d->category;
+  r.Swapped=d->client_swapped;
+  r.Len=Len;
+  r.Reserved=0;
+  memcpy(r.Data, d->data, Len);
+  captureRecord(p, r);
 returning:
   XRecordFreeData(d);
 }
 
+/****************************************************************************/
+/*! Puts the keyboard mapping into the capture, so its keycodes can be
+    decoded. Done at the start and again whenever the mapping changes.
+*/
+/****************************************************************************/
+void captureKeys(Priv *p)
+{
+  vector<CaptureRecord> Records;
+
+  captureKeyMap(p->Keys, Records);
+  for (size_t i=0; i < Records.size(); i++)
+  {
+	*ringSlot(*p->Raw)=Records[i];
+	ringPush(*p->Raw);
+  }
+  p->KeysCaptured=p->Keys.Changes;
+}
+
+/****************************************************************************/
+/*! Writes the \a Count pieces at \a Io to the standard output, all in one
+    writev unless it writes less.
+*/
+/****************************************************************************/
+void writeAll (struct iovec * Io, int Count) {
+
+  ssize_t n;
+
+  while ( Count ) {
+	if ( ( n = writev ( STDOUT_FILENO, Io, Count ) ) < 0 ) {
+	  if ( errno == EINTR ) continue;
+	  WriteFailed = true;
+	  return;
+	}
+
+	// skip what was written, the rest goes in the next writev
+	while ( Count && (size_t) n >= Io->iov_len ) {
+	  n -= Io->iov_len;
+	  Io++;
+	  Count--;
+	}
+	if ( Count ) {
+	  Io->iov_base = (char *) Io->iov_base + n;
+	  Io->iov_len -= n;
+	}
+  }
+
+  // syncing a pipe fails, it doesn't matter
+  if ( Fsync ) fsync ( STDOUT_FILENO );
+}
+
+/****************************************************************************/
+/*! Writes \a Out to the standard output and empties it.
+*/
+/****************************************************************************/
+void writeOut (string & Out) {
+
+  struct iovec Io;
+
+  Io.iov_base = (void *) Out.data ();
+  Io.iov_len = Out.size ();
+  writeAll ( &Io, 1 );
+  Out.clear ();
+}
+
+/****************************************************************************/
+/*! The writer thread: formats the events from \a Events and writes them
+    out as the Flush policy says, until the ring is closed.
+*/
+/****************************************************************************/
+void writeEvents (RecordRing * Events) {
+
+  RecordedEvent * r;
+  string Out;
+  bool Done, Due;
+
+  do {
+	ringSleep ( *Events, [Events] { return ringCount ( *Events ) >= wakeThreshold ()
+									  || Events->Closed.load () || FlushDue.load (); } );
+
+	// what was pushed before the ring was closed is drained below
+	Done = Events->Closed.load ();
+	while ( ( r = ringPeek ( *Events ) ) ) {
+	  formatMacroEvent ( Out, r->Ev, (const char *) &r->Region );
+	  ringPop ( *Events );
+	}
+
+	Due = FlushDue.exchange ( false );
+	if ( ! Out.empty () && ( Done || Due || Flush == FlushEvent || Out.size () >= WriteBlock ) )
+	  writeOut ( Out );
+  } while ( ! Done );
+}
+
+/****************************************************************************/
+/*! The writer thread of a raw capture: writes the records of \a Raw as the
+    Flush policy says, until the ring is closed. Nothing is formatted, the
+	records are written from the ring itself.
+*/
+/****************************************************************************/
+void writeCapture (CaptureRing * Raw) {
+
+  CaptureRecord * First;
+  struct iovec Io[2];
+  size_t Count, n;
+  bool Done, Due;
+
+  do {
+	ringSleep ( *Raw, [Raw] { return ringCount ( *Raw ) >= wakeThreshold ()
+								|| Raw->Closed.load () || FlushDue.load (); } );
+
+	Done = Raw->Closed.load ();
+	Due = FlushDue.exchange ( false );
+	Count = ringCount ( *Raw );
+	if ( ! Count || ! ( Done || Due || Flush == FlushEvent
+						|| Count * sizeof (CaptureRecord) >= WriteBlock ) )
+	  continue;
+
+	// in one piece, or two if the records wrap around the end of the ring
+	n = min ( ringSpan ( *Raw, First ), Count );
+	Io[0].iov_base = First;
+	Io[0].iov_len = n * sizeof (CaptureRecord);
+	Io[1].iov_base = Raw->Slots;
+	Io[1].iov_len = ( Count - n ) * sizeof (CaptureRecord);
+	writeAll ( Io, Count > n ? 2 : 1 );
+	ringPopMany ( *Raw, Count );
+  } while ( ! Done );
+}
+
+/****************************************************************************/
+/*! Wakes the writer of whichever ring \a priv records into.
+*/
+/****************************************************************************/
+void wakeWriter (Priv & priv) {
+
+  if ( priv.Raw ) ringWake ( *priv.Raw );
+  else ringWake ( *priv.Events );
+}
+
+/****************************************************************************/
+/*! Called every TickInterval: lets the writer write out what it has and
+    now and then traces how many events were recorded and dropped.
+*/
+/****************************************************************************/
+void tick (Priv & priv, unsigned long & Ticks, unsigned long & Reported) {
+
+  if ( Flush == FlushTick ) {
+	FlushDue = true;
+	wakeWriter ( priv );
+  }
+
+  if ( ++Ticks % StatTicks ) return;
+  trace ( TraceInfo, 0, "Recorded events", TraceOneArg, priv.Recorded );
+  if ( priv.Dropped > Reported )
+	trace ( TraceWarn, 0, "Events dropped, the writer can't keep up", TraceOneArg,
+			priv.Dropped - Reported );
+  Reported = priv.Dropped;
+}
+
 /****************************************************************************/
 /*! Main event-loop of the application. Loops until a key with the keycode
     \a QuitKey is pressed. Sends all mouse- and key-events to the remote
@@ -463,11 +859,41 @@ void eventLoop (Display * LocalDpy, int LocalScreen,
   XRecordRange *rr;
   XRecordClientSpec rcs;
   Priv         priv;
+  CaptureHeader Header;
+  struct iovec Io;
+  thread Writer;
   int rootx, rooty, winx, winy;
   unsigned int mmask;
   Bool ret;
   Status sret;
+  sigset_t Signals;
+  struct signalfd_siginfo Signal;
+  struct itimerspec Interval;
+  struct pollfd Fds[4];
+  int SigFd, TickFd;
+  uint64_t Expired;
+  unsigned long Ticks = 0, Reported = 0;
   
+  // the quit signals are read from a descriptor, by no thread of ours
+  sigemptyset(&Signals);
+  sigaddset(&Signals, SIGINT);
+  sigaddset(&Signals, SIGTERM);
+  sigaddset(&Signals, SIGHUP);
+  sigprocmask(SIG_BLOCK, &Signals, 0);
+  SigFd=signalfd(-1, &Signals, SFD_CLOEXEC);
+
+  TickFd=timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  Interval.it_interval.tv_sec=0;
+  Interval.it_interval.tv_nsec=TickInterval * 1000;
+  Interval.it_value=Interval.it_interval;
+  timerfd_settime(TickFd, 0, &Interval, 0);
+
+  if (SigFd < 0 || TickFd < 0)
+  {
+	cerr << "Could not create the signal and timer descriptors, aborting." << endl;
+	exit(EXIT_FAILURE);
+  }
+
   // get the root window and set default target
   Root = RootWindow ( LocalDpy, LocalScreen );
 
@@ -488,30 +914,121 @@ void eventLoop (Display * LocalDpy, int LocalScreen,
   	cerr << "Could not create a record context, aborting." << endl;
   	exit(EXIT_FAILURE);
   }
-  priv.x=rootx;
-  priv.y=rooty;
-  priv.mmoved=1;
-  priv.Status2=0;
-  priv.Status1=2;
   priv.doit=1;
   priv.QuitKey=QuitKey;
+  priv.CheckKey=CheckKey;
+  priv.Screen=LocalScreen;
   priv.LocalDpy=LocalDpy;
   priv.RecDpy=RecDpy;
   priv.rc=rc;
+  priv.Events=0;
+  priv.Raw=0;
+  priv.Recorded=0;
+  priv.Dropped=0;
+
+  startDecoder(priv.Dec, rootx, rooty, Timing);
+  priv.Dec.QuitKey=QuitKey;
+  priv.Dec.CheckKey=HasCheckKey ? CheckKey : 0;
+  priv.Dec.Keys=&priv.Keys;
+  priv.Dec.Emit=emitEvent;
+  priv.Dec.Arg=&priv;
+  priv.Dec.Tolerance=Tolerance;
+  priv.Dec.Resolution=Resolution;
+
+  if (Raw)
+  {
+	// the header goes out before the writer starts
+	beginCapture(Header, rootx, rooty);
+	Io.iov_base=&Header;
+	Io.iov_len=sizeof(Header);
+	writeAll(&Io, 1);
+	priv.Raw=new CaptureRing;
+	Writer=thread(writeCapture, priv.Raw);
+  }
+  else
+  {
+	priv.Events=new RecordRing;
+	Writer=thread(writeEvents, priv.Events);
+  }
+
+  // cache the keyboard mapping, it is updated from MappingNotify events
+  loadKeyMap(LocalDpy, priv.Keys);
+  selectKeyMapEvents(LocalDpy, priv.Keys);
+  if (Raw) captureKeys(&priv);
+
+  if (HasCheckKey && !openGrab(LocalDpy, LocalScreen, min(RegionWidth, DisplayWidth(LocalDpy, LocalScreen)),
+							   min(RegionHeight, DisplayHeight(LocalDpy, LocalScreen)), priv.Region))
+  {
+	cerr << "Invalid checkpoint region, aborting." << endl;
+	exit(EXIT_FAILURE);
+  }
 
-  if (!XRecordEnableContextAsync(RecDpy, rc, eventCallback, (XPointer) &priv))
+  if (!XRecordEnableContextAsync(RecDpy, rc, Raw ? captureCallback : eventCallback, (XPointer) &priv))
   {
   	cerr << "Could not enable the record context, aborting." << endl;
   	exit(EXIT_FAILURE);
   }
 
-  while (priv.doit) XRecordProcessReplies(RecDpy);
+  // sleep until the server sends something, a signal comes or it is
+  // time to tick; the replies and events read are handled at the top
+  Fds[0].fd=ConnectionNumber(RecDpy);
+  Fds[1].fd=ConnectionNumber(LocalDpy);
+  Fds[2].fd=SigFd;
+  Fds[3].fd=TickFd;
+  for (int i=0; i < 4; i++) Fds[i].events=POLLIN;
+
+  while (priv.doit)
+  {
+	XRecordProcessReplies(RecDpy);
+	processKeyMapEvents(LocalDpy, priv.Keys);
+	if (Raw && priv.Keys.Changes != priv.KeysCaptured) captureKeys(&priv);
+	if (!priv.doit) break;
+	if (WriteFailed)
+	{
+	  cerr << "Could not write the events, exiting..." << endl;
+	  break;
+	}
+
+	XFlush(LocalDpy);
+	if (poll(Fds, 4, -1) < 0 && errno != EINTR)
+	{
+	  cerr << "poll failed, exiting..." << endl;
+	  break;
+	}
+
+	if ((Fds[2].revents & POLLIN) && read(SigFd, &Signal, sizeof(Signal)) == sizeof(Signal))
+	{
+	  cerr << "Got signal " << Signal.ssi_signo << ", so exiting..." << endl;
+	  priv.doit=0;
+	}
+	if ((Fds[3].revents & POLLIN) && read(TickFd, &Expired, sizeof(Expired)) == sizeof(Expired))
+	  tick(priv, Ticks, Reported);
+  }
 
   sret=XRecordDisableContext(LocalDpy, rc);
   if (!sret) cerr << "XRecordDisableContext failed!" << endl;
   sret=XRecordFreeContext(LocalDpy, rc);
   if (!sret) cerr << "XRecordFreeContext failed!" << endl;
   XFree(rr);
+  closeGrab(LocalDpy, priv.Region);
+
+  // let the writer finish
+  finishDecoder(priv.Dec);
+  if (priv.Raw) ringClose(*priv.Raw);
+  else ringClose(*priv.Events);
+  Writer.join();
+  delete priv.Events;
+  delete priv.Raw;
+  close(SigFd);
+  close(TickFd);
+
+  cerr << "Recorded " << priv.Recorded << " events." << endl;
+  if (priv.Dropped)
+	cerr << priv.Dropped << " events were dropped, the output could not keep up." << endl;
+  if (Tolerance && priv.Dec.DragPoints)
+	cerr << "Simplified the drags to " << priv.Dec.DragKept << " of " << priv.Dec.DragPoints
+		 << " points, " << fixed << setprecision(1)
+		 << (double) priv.Dec.DragPoints / max(priv.Dec.DragKept, 1UL) << ":1." << endl;
 }
 
 
@@ -528,6 +1045,11 @@ int main (int argc, char * argv[]) {
 
   // parse commandline arguments
   parseCommandLine ( argc, argv );
+
+  if ( ! traceOpen ( TracePath, Trace ) ) {
+	cerr << PROG << ": could not open trace file \"" << TracePath << "\"." << endl;
+	exit ( EXIT_FAILURE );
+  }
   
   // open the local display twice
   Display * LocalDpy = localDisplay ();